@@ -0,0 +1,287 @@
+#include "archivereader.h"
+#include "codec.h"
+
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <zstd.h>
+#include <Poco/Path.h>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/Exception.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/BufferedStreamBuf.h>
+
+using Poco::UInt64;
+
+namespace
+{
+    const std::streamsize BlockSize = 512;
+    const std::streamsize BufferSize = 1 << 16;
+
+    // Header field offsets and lengths of ustar format
+    enum Field
+    {
+        NameOffset = 0, NameLength = 100,
+        SizeOffset = 124, SizeLength = 12,
+        CheckOffset = 148, CheckLength = 8,
+        TypeOffset = 156,
+        MagicOffset = 257,
+        PrefixOffset = 345, PrefixLength = 155
+    };
+
+    std::string field(const char* block, size_t offset, size_t length)
+    {
+        const char* begin = block + offset;
+        return std::string(begin, std::find(begin, begin + length, '\0'));
+    }
+
+    // Octal number, or base-256 big endian one if high bit is set (gnu)
+    UInt64 number(const char* block, size_t offset, size_t length)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(block + offset);
+        UInt64 value = 0;
+        if (p[0] & 0x80) {
+            value = p[0] & 0x7f;
+            for (size_t i = 1; i < length; ++i) value = (value << 8) | p[i];
+            return value;
+        }
+        for (size_t i = 0; i < length && p[i]; ++i) {
+            if (' ' == p[i]) continue;
+            if (p[i] < '0' || p[i] > '7') break;
+            value = (value << 3) | (p[i] - '0');
+        }
+        return value;
+    }
+
+    bool validChecksum(const char* block)
+    {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(block);
+        UInt64 sum = 0;
+        for (std::streamsize i = 0; i < BlockSize; ++i)
+            sum += (i >= CheckOffset && i < CheckOffset + CheckLength) ? ' ' : p[i];
+        return number(block, CheckOffset, CheckLength) == sum;
+    }
+
+    // Parent directories could be created by concurrent reader at the same time
+    void createDirectories(const Poco::Path& path)
+    {
+        for (int attempt = 0;; ++attempt) {
+            try {
+                Poco::File(path).createDirectories();
+                return;
+            } catch (Poco::FileExistsException&) {
+                if (attempt > 8) throw;
+            }
+        }
+    }
+
+    // Decode zstd frames from underlying stream
+    class ZstdStreamBuf : public Poco::BufferedStreamBuf
+    {
+    public:
+        explicit ZstdStreamBuf(std::istream& in) :
+            Poco::BufferedStreamBuf(BufferSize, std::ios::in),
+            _in(in), _stream(ZSTD_createDStream()), _input(ZSTD_DStreamInSize()), _pos(0), _size(0), _pending(0)
+        {
+            ZSTD_initDStream(_stream);
+        }
+
+        ~ZstdStreamBuf()
+        {
+            ZSTD_freeDStream(_stream);
+        }
+
+    protected:
+        int readFromDevice(char* buffer, std::streamsize length)
+        {
+            ZSTD_outBuffer out = { buffer, static_cast<size_t>(length), 0 };
+            while (!out.pos) {
+                if (_pos == _size) {
+                    _in.read(&_input[0], _input.size());
+                    _size = static_cast<size_t>(_in.gcount());
+                    _pos = 0;
+                    if (!_size && !_pending) return 0;
+                }
+                // At end of input decoder is called with empty buffer to flush output it holds,
+                // frame is truncated only if it still waits for input and gives nothing
+                ZSTD_inBuffer in = { &_input[_pos], _size - _pos, 0 };
+                _pending = ZSTD_decompressStream(_stream, &out, &in);
+                if (ZSTD_isError(_pending))
+                    throw Poco::DataFormatException("zstd", ZSTD_getErrorName(_pending));
+                if (!_size && _pending && !out.pos)
+                    throw Poco::DataFormatException("Truncated zstd stream");
+                _pos += in.pos;
+            }
+            return static_cast<int>(out.pos);
+        }
+
+    private:
+        std::istream& _in;
+        ZSTD_DStream* _stream;
+        std::vector<char> _input;
+        size_t _pos, _size, _pending;
+    };
+}
+
+ArchiveReader::ArchiveReader(const std::string& path, const Codec& codec) :
+    _path(path), _file(path, std::ios::in | std::ios::binary), _in(&_file), _remaining(0), _padding(0)
+{
+    if (".tar.gz" == codec.extension()) {
+        _stream.reset(new Poco::InflatingInputStream(_file, Poco::InflatingStreamBuf::STREAM_GZIP));
+        _in = _stream.get();
+    } else if (".tar.zst" == codec.extension()) {
+        _decoder.reset(new ZstdStreamBuf(_file));
+        _stream.reset(new std::istream(_decoder.get()));
+        _in = _stream.get();
+    } else if (".tar" != codec.extension())
+        throw Poco::NotImplementedException("No built in decoder for " + codec.name());
+
+    // Rethrow decoder errors instead of silent end of stream
+    _in->exceptions(std::ios::badbit);
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    // Decoding stream should go before its buffer and file
+    _stream.reset();
+    _decoder.reset();
+}
+
+bool ArchiveReader::supports(const Codec& codec)
+{
+    const std::string& ext = codec.extension();
+    return ".tar" == ext || ".tar.gz" == ext || ".tar.zst" == ext;
+}
+
+void ArchiveReader::readBlock(char* block, bool allowEnd)
+{
+    _in->read(block, BlockSize);
+    if (BlockSize == _in->gcount()) return;
+    if (allowEnd && !_in->gcount()) {
+        memset(block, 0, BlockSize);
+        return;
+    }
+    throw Poco::DataFormatException("Unexpected end of archive " + _path);
+}
+
+void ArchiveReader::skip(UInt64 size)
+{
+    char buffer[BufferSize];
+    while (size) {
+        const std::streamsize count = static_cast<std::streamsize>(std::min<UInt64>(size, BufferSize));
+        _in->read(buffer, count);
+        if (_in->gcount() != count)
+            throw Poco::DataFormatException("Unexpected end of archive " + _path);
+        size -= count;
+    }
+}
+
+std::string ArchiveReader::readString(UInt64 size)
+{
+    if (size > (1 << 20))
+        throw Poco::DataFormatException("Too long extended header in " + _path);
+    std::string value(static_cast<size_t>(size), '\0');
+    if (size) _in->read(&value[0], static_cast<std::streamsize>(size));
+    if (static_cast<UInt64>(_in->gcount()) != size)
+        throw Poco::DataFormatException("Unexpected end of archive " + _path);
+    skip((BlockSize - size % BlockSize) % BlockSize);
+    return value;
+}
+
+bool ArchiveReader::next(Entry& entry)
+{
+    skip(_remaining + _padding);
+    _remaining = _padding = 0;
+
+    std::string longName;
+    UInt64 paxSize = 0;
+    bool hasPaxSize = false;
+    char block[BlockSize];
+    for (;;) {
+        readBlock(block, true);
+        if (!block[0] && !block[CheckOffset]) return false; // zero block ends archive
+        if (!validChecksum(block))
+            throw Poco::DataFormatException("Invalid header checksum in " + _path);
+
+        const char type = block[TypeOffset];
+        const UInt64 size = number(block, SizeOffset, SizeLength);
+        if ('L' == type) {
+            // gnu long name precedes its member
+            longName = readString(size).c_str();
+            continue;
+        }
+        if ('x' == type) {
+            // pax records "length key=value\n"
+            const std::string records = readString(size);
+            for (size_t pos = 0; pos < records.size();) {
+                const size_t length = strtoul(records.c_str() + pos, 0, 10);
+                const size_t space = records.find(' ', pos);
+                const size_t equal = records.find('=', pos);
+                if (!length || std::string::npos == space || std::string::npos == equal ||
+                        pos + length > records.size())
+                    throw Poco::DataFormatException("Invalid pax header in " + _path);
+                const std::string key = records.substr(space + 1, equal - space - 1);
+                const std::string value = records.substr(equal + 1, pos + length - equal - 2);
+                if ("path" == key) longName = value;
+                else if ("size" == key) {
+                    paxSize = strtoull(value.c_str(), 0, 10);
+                    hasPaxSize = true;
+                }
+                pos += length;
+            }
+            continue;
+        }
+        if ('g' == type || 'K' == type) {
+            readString(size);
+            continue;
+        }
+
+        entry.name = longName;
+        if (entry.name.empty()) {
+            entry.name = field(block, NameOffset, NameLength);
+            const std::string prefix = field(block, PrefixOffset, PrefixLength);
+            // gnu format keeps other fields there, only posix one has prefix
+            if (!prefix.empty() && 0 == memcmp(block + MagicOffset, "ustar\0", 6))
+                entry.name = prefix + "/" + entry.name;
+        }
+        entry.size = hasPaxSize ? paxSize : size;
+        entry.type = ('0' == type || '\0' == type || '7' == type) ? Entry::Regular
+            : ('5' == type ? Entry::Directory : Entry::Other);
+        _remaining = entry.size;
+        _padding = (BlockSize - _remaining % BlockSize) % BlockSize;
+        return true;
+    }
+}
+
+std::streamsize ArchiveReader::read(char* buffer, std::streamsize size)
+{
+    const std::streamsize count = static_cast<std::streamsize>(std::min<UInt64>(size, _remaining));
+    if (!count) return 0;
+    _in->read(buffer, count);
+    if (_in->gcount() != count)
+        throw Poco::DataFormatException("Unexpected end of archive " + _path);
+    _remaining -= count;
+    return count;
+}
+
+size_t ArchiveReader::extract(const std::set<std::string>& names, const std::string& dir)
+{
+    size_t found = 0;
+    Entry entry;
+    std::vector<char> buffer(BufferSize);
+    // Stop as soon as all requested members are out, rest of archive is not decoded
+    while (found < names.size() && next(entry)) {
+        if (Entry::Regular != entry.type || !names.count(entry.name)) continue;
+
+        Poco::Path path(dir + entry.name.substr(1));
+        createDirectories(path.parent());
+        Poco::FileOutputStream out(path.toString(), std::ios::out | std::ios::trunc | std::ios::binary);
+        for (std::streamsize count; (count = read(&buffer[0], BufferSize));)
+            out.write(&buffer[0], count);
+        out.close();
+        ++found;
+    }
+    return found;
+}
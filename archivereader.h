@@ -0,0 +1,55 @@
+#ifndef ARCHIVEREADER_H
+#define ARCHIVEREADER_H
+
+#include <set>
+#include <memory>
+#include <string>
+#include <istream>
+#include <Poco/Types.h>
+#include <Poco/FileStream.h>
+
+class Codec;
+
+// In-process reader of tar archives (ustar, gnu and pax headers)
+// compressed by codecs with built in decoder
+class ArchiveReader
+{
+public:
+    struct Entry
+    {
+        enum Type { Regular, Directory, Other };
+
+        std::string name; // member name as stored, i.e. "./dir/file"
+        Poco::UInt64 size;
+        Type type;
+    };
+
+    ArchiveReader(const std::string& path, const Codec& codec);
+    ~ArchiveReader();
+
+    // Codec could be decoded without external program
+    static bool supports(const Codec& codec);
+
+    // Move to next member, false at the end of archive
+    bool next(Entry& entry);
+    // Read content of current member, return 0 at its end
+    std::streamsize read(char* buffer, std::streamsize size);
+
+    // Extract regular files with given member names to dir, return count of extracted
+    size_t extract(const std::set<std::string>& names, const std::string& dir);
+
+private:
+    void readBlock(char* block, bool allowEnd = false);
+    void skip(Poco::UInt64 size);
+    std::string readString(Poco::UInt64 size);
+
+private:
+    std::string _path;
+    Poco::FileInputStream _file;
+    std::auto_ptr<std::streambuf> _decoder;
+    std::auto_ptr<std::istream> _stream;
+    std::istream* _in;
+    Poco::UInt64 _remaining, _padding; // of current member
+};
+
+#endif // ARCHIVEREADER_H
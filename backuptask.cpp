@@ -1,104 +1,626 @@
 #include "backuptask.h"
 #include "ftpclient.h"
+#include "binarydelta.h"
+#include "codec.h"
+#include "archivereader.h"
+#include "manifest.h"
+#include "journal.h"
+#include "listparser.h"
+#include "replicator.h"
+#include "tracer.h"
 #include "main.h"
 
+#include <cstdio>
 #include <memory>
+#include <algorithm>
+#include <unistd.h>
 //#include <ctime>
 #include <Poco/File.h>
+#include <Poco/Path.h>
 #include <Poco/FileStream.h>
+#include <Poco/TemporaryFile.h>
+#include <Poco/SharedPtr.h>
+#include <Poco/Thread.h>
+#include <Poco/Event.h>
 #include <Poco/Format.h>
 #include <Poco/NumberParser.h>
+#include <Poco/String.h>
+#include <Poco/Checksum.h>
 #include <Poco/StringTokenizer.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/DateTime.h>
 #include <Poco/DateTimeFormat.h>
 #include <Poco/DateTimeFormatter.h>
 #include <Poco/Net/NetException.h>
 
+namespace
+{
+    unsigned fileCrc32(const std::string& path)
+    {
+        Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+        Poco::FileInputStream fis(path, std::ios::in | std::ios::binary);
+        char buffer[65536];
+        while (fis.read(buffer, sizeof(buffer)) || fis.gcount())
+            crc32.update(buffer, static_cast<unsigned>(fis.gcount()));
+        return crc32.checksum();
+    }
+
+    // Sum sizes of all files and of files worth to compress
+    void measureCompressible(const Poco::File& dir, const std::set<std::string>& skipExt, double maxEntropy,
+                             Poco::UInt64& total, Poco::UInt64& compressible)
+    {
+        for (Poco::DirectoryIterator dit(dir), end; dit != end; ++dit) {
+            if (dit->isDirectory()) {
+                measureCompressible(*dit, skipExt, maxEntropy, total, compressible);
+                continue;
+            }
+            const Poco::UInt64 size = dit->getSize();
+            total += size;
+            if (Codec::isCompressible(dit->path(), skipExt, maxEntropy))
+                compressible += size;
+        }
+    }
+}
+
+// Workers take extraction jobs from shared list until it is empty or one fails
+class BackupTask::Extractor : public Poco::Runnable
+{
+public:
+    Extractor(const ExtractJobs_t& jobs, RestoreTask* task) :
+        _jobs(jobs), _task(task), _next(0), _done(0), _total(0)
+    {
+        for (size_t i = 0, count = jobs.size(); i < count; ++i)
+            _total += jobs[i].files->size();
+    }
+
+    void run()
+    {
+        for (;;) {
+            size_t i;
+            {
+                Poco::FastMutex::ScopedLock lock(_mutex);
+                if (_next == _jobs.size() || !_error.empty() || (_task && _task->isCancelled()))
+                    return;
+                i = _next++;
+            }
+
+            std::string error;
+            try { extract(_jobs[i].archive, *_jobs[i].files, _jobs[i].dir); }
+            catch (Poco::Exception& ex) { error = ex.displayText(); }
+            catch (std::exception& ex) { error = ex.what(); }
+
+            Poco::FastMutex::ScopedLock lock(_mutex);
+            if (!error.empty()) {
+                if (_error.empty()) _error = _jobs[i].archive + ": " + error;
+                return;
+            }
+            _done += _jobs[i].files->size();
+            if (_total) reportProgress(_task, float(_done) / _total);
+        }
+    }
+
+    const std::string& error() const { return _error; }
+
+private:
+    const ExtractJobs_t& _jobs;
+    RestoreTask* _task;
+    Poco::FastMutex _mutex;
+    size_t _next, _done, _total;
+    std::string _error;
+};
+
+// Reads archives of one site on verify.threads threads, verify.maxRate
+// (MB/s of archive content, 0 for unlimited) is shared by all of them
+class BackupTask::Verifier : public Poco::Runnable
+{
+public:
+    struct Job
+    {
+        std::string archive; // name without codec extension
+        std::string path;
+        Data::TimePoint_t timePoint;
+        bool full;
+        unsigned members, bad;
+        std::string error;
+        std::vector<unsigned> damaged; // ids of files with damaged current version
+    };
+    typedef std::vector<Job> Jobs_t;
+
+    Verifier(Jobs_t& jobs, const Data::StoredVersion::Map_t& stored) :
+        _jobs(jobs), _stored(stored), _next(0), _bytes(0),
+        _maxRate(Poco::UInt64(std::max(0, App::get().config().getInt("verify.maxRate", 0))) << 20)
+    {
+    }
+
+    void run()
+    {
+        for (;;) {
+            size_t i;
+            {
+                Poco::FastMutex::ScopedLock lock(_mutex);
+                if (_next == _jobs.size()) return;
+                i = _next++;
+            }
+
+            Job& job = _jobs[i];
+            try { verify(job); }
+            catch (Poco::Exception& ex) { job.error = ex.displayText(); }
+            catch (std::exception& ex) { job.error = ex.what(); }
+            if (!job.error.empty()) damageAll(job);
+        }
+    }
+
+private:
+    void verify(Job& job)
+    {
+        const Codec* codec = Codec::byArchive(job.path);
+        if (!codec)
+            throw Poco::NotFoundException("Archive not found " + job.path);
+
+        // No built in decoder, only stream integrity is checked by tar
+        if (!ArchiveReader::supports(*codec)) {
+            int result = system(Poco::format("tar %s -tf \"%s%s\" > /dev/null",
+                codec->tarOption(), job.path, codec->extension()).c_str());
+            if (result)
+                throw Poco::DataFormatException("tar could not read archive", result);
+            return;
+        }
+
+        ArchiveReader reader(job.path + codec->extension(), *codec);
+        ArchiveReader::Entry entry;
+        std::set<std::string> seen;
+        std::vector<char> buffer(1 << 16);
+        while (reader.next(entry)) {
+            if (ArchiveReader::Entry::Regular != entry.type) continue;
+            ++job.members;
+            Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+            for (std::streamsize n; (n = reader.read(&buffer[0], buffer.size())) > 0; ) {
+                crc32.update(&buffer[0], static_cast<unsigned>(n));
+                throttle(n);
+            }
+
+            const std::string name = entry.name.substr(1); // skip "."
+            Data::StoredVersion::Map_t::const_iterator it = _stored.find(name);
+            if (_stored.end() == it || !refers(job, it->second)) continue;
+            seen.insert(name);
+            // Delta and base of it differ from current content, they are only read through
+            if (isCurrent(job, it->second) && crc32.checksum() != it->second.crc32) {
+                ++job.bad;
+                job.damaged.push_back(it->second.fileId);
+            }
+        }
+
+        // Member needed by current version is lost
+        for (Data::StoredVersion::Map_t::const_iterator it = _stored.begin(), end = _stored.end(); it != end; ++it)
+            if (refers(job, it->second) && !seen.count(it->first)) {
+                ++job.bad;
+                job.damaged.push_back(it->second.fileId);
+            }
+    }
+
+    // Current version is full content in this archive
+    static bool isCurrent(const Job& job, const Data::StoredVersion& version)
+    {
+        if (job.full)
+            return version.timePoint <= job.timePoint && Data::File::Deleted != version.status;
+        return version.timePoint == job.timePoint &&
+            (Data::File::Added == version.status || Data::File::Modified == version.status);
+    }
+
+    // Current version is restored from this archive, itself or delta or base of it
+    static bool refers(const Job& job, const Data::StoredVersion& version)
+    {
+        if (job.full || Data::File::Deleted == version.status)
+            return isCurrent(job, version);
+        return version.archives.end() != std::find(version.archives.begin(), version.archives.end(), job.timePoint);
+    }
+
+    // Unreadable archive: every current version restored from it is damaged
+    void damageAll(Job& job)
+    {
+        for (Data::StoredVersion::Map_t::const_iterator it = _stored.begin(), end = _stored.end(); it != end; ++it)
+            if (refers(job, it->second))
+                job.damaged.push_back(it->second.fileId);
+    }
+
+    void throttle(std::streamsize bytes)
+    {
+        if (!_maxRate) return;
+        Poco::Timestamp::TimeDiff wait;
+        {
+            Poco::FastMutex::ScopedLock lock(_mutex);
+            _bytes += bytes;
+            wait = Poco::Timestamp::TimeDiff(double(_bytes) / _maxRate * Poco::Timestamp::resolution()) -
+                _start.elapsed();
+        }
+        if (wait > 1000) Poco::Thread::sleep(static_cast<long>(wait / 1000));
+    }
+
+private:
+    Jobs_t& _jobs;
+    const Data::StoredVersion::Map_t& _stored;
+    Poco::FastMutex _mutex;
+    size_t _next;
+    Poco::UInt64 _bytes, _maxRate; // bytes read by all threads, limit per second
+    Poco::Timestamp _start;
+};
+
+// Listing of the site passed entry by entry to runTask(). With capacity it is made
+// by own thread and at most capacity entries wait, so listing blocks while
+// downloads are behind. Without capacity all is listed by start() on caller thread.
+class BackupTask::Lister : public Poco::Runnable
+{
+public:
+    Lister(BackupTask& task, size_t capacity) :
+        _task(task), _capacity(capacity), _count(0), _started(false), _done(false), _cancelled(false)
+    {
+    }
+
+    ~Lister()
+    {
+        cancel(); // runTask() failed while listing goes on
+        if (_started) _thread.join();
+    }
+
+    void start()
+    {
+        if (!_capacity) {
+            run();
+            join();
+            return;
+        }
+        _thread.start(*this);
+        _started = true;
+    }
+
+    // Wait for listing thread and throw its error
+    void join()
+    {
+        if (_started) {
+            _thread.join();
+            _started = false;
+        }
+        if (_error.get()) _error->rethrow();
+    }
+
+    void push(const Data::File::Ptr_t& file)
+    {
+        for (;;) {
+            {
+                Poco::FastMutex::ScopedLock lock(_mutex);
+                if (_cancelled)
+                    throw Poco::ApplicationException("Listing cancelled");
+                if (!_capacity || _entries.size() < _capacity) {
+                    _entries.push_back(file);
+                    ++_count;
+                    _ready.set();
+                    return;
+                }
+            }
+            _space.wait();
+        }
+    }
+
+    // Take next entry, false when listing is complete and all entries are taken
+    bool pop(Data::File::Ptr_t& file)
+    {
+        for (;;) {
+            {
+                Poco::FastMutex::ScopedLock lock(_mutex);
+                if (!_entries.empty()) {
+                    file = _entries.front();
+                    _entries.pop_front();
+                    _space.set();
+                    return true;
+                }
+                if (_done) return false;
+            }
+            _ready.wait();
+        }
+    }
+
+    // Entries not taken yet, all of them after start() without capacity
+    const Listing_t& entries() const { return _entries; }
+    size_t count() const { return _count; }
+
+private:
+    void run()
+    {
+        try { _task.listFtpFiles(*this); }
+        catch (Poco::Exception& ex) { _error.reset(ex.clone()); }
+        catch (std::exception& ex) { _error.reset(new Poco::ApplicationException(ex.what())); }
+
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        _done = true;
+        _ready.set();
+    }
+
+    void cancel()
+    {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        _cancelled = true;
+        _space.set();
+    }
+
+private:
+    BackupTask& _task;
+    const size_t _capacity;
+    Listing_t _entries;
+    size_t _count; // listed in total
+    bool _started, _done, _cancelled;
+    std::auto_ptr<Poco::Exception> _error;
+    Poco::FastMutex _mutex;
+    Poco::Event _ready, _space;
+    Poco::Thread _thread;
+};
+
+// tar reading names of stored files from pipe, so archive is written while
+// downloads go on. Archive is named <workdir>.part until it is complete.
+class BackupTask::Archiver
+{
+public:
+    Archiver(const std::string& workdir, const Codec& codec) :
+        _workdir(workdir), _codec(codec), _pipe(0)
+    {
+    }
+
+    ~Archiver()
+    {
+        if (!_pipe) return;
+        pclose(_pipe); // run failed, partial archive is dropped
+        Poco::File part(_workdir + ".part" + _codec.extension());
+        if (part.exists()) part.remove();
+    }
+
+    // File is not changed in workdir after it is added
+    void add(const std::string& fullName)
+    {
+        if (!_pipe) {
+            App::logger().information("Creating archive " + _workdir + _codec.extension());
+            _pipe = popen(Poco::format("tar --directory=\"%s\" --no-recursion --files-from=- %s -cf \"%s.part%s\"",
+                _workdir, _codec.tarOption(), _workdir, _codec.extension()).c_str(), "w");
+            if (!_pipe)
+                throw Poco::SystemException("Unable to start tar");
+        }
+        if (fprintf(_pipe, ".%s\n", fullName.c_str()) < 0 || fflush(_pipe))
+            throw Poco::WriteFileException("tar stopped reading file names");
+    }
 
-BackupTask::BackupTask(Data::Site::Ptr_t site, StrListPtr_t batch) :
-    Task("BackupTask"), _ftp(0), _site(site), _batch(batch),
-    _timePoint(Poco::format("%?u", Data::currentTimePoint()))
+    // Wait for tar and give archive its name, false if nothing was added
+    bool finish()
+    {
+        if (!_pipe) return false;
+        int result = pclose(_pipe);
+        _pipe = 0;
+        Poco::File part(_workdir + ".part" + _codec.extension());
+        if (result) {
+            if (part.exists()) part.remove();
+            throw Poco::ApplicationException("tar failed", result);
+        }
+        part.renameTo(_workdir + _codec.extension());
+        return true;
+    }
+
+private:
+    std::string _workdir;
+    const Codec& _codec;
+    FILE* _pipe;
+};
+
+bool BackupTask::_keepConnections = false;
+Poco::FastMutex BackupTask::_connectionsMutex;
+std::map<unsigned, BackupTask::FtpClient*> BackupTask::_connections;
+
+BackupTask::BackupTask(Data::Site::Ptr_t site, StrListPtr_t batch, bool estimate) :
+    Task("BackupTask"), _ftp(0), _transfer(0), _site(site), _batch(batch),
+    _estimateOnly(estimate), _succeeded(false),
+    _deltaEnabled(App::get().config().getBool("delta.enabled", false) && !mirrorMode()), // mirror keeps full files
+    _deltaBlock(App::get().config().getInt("delta.block", 4096)),
+    _deltaChain(App::get().config().getInt("delta.chain", 16)),
+    _deltaMinSize(App::get().config().getInt("delta.minSize", 65536)), _listOffset(0)
 {
+    _estimate.added = _estimate.modified = _estimate.deleted = 0;
+    _estimate.bytes = 0;
     ASSERT_LOG(0 != site.get())
-    writeLog("Connecting to ftp server");
-    reconnect();
+    _timePoint = Poco::format("%?u", site->timePoint); // site is checked first
+}
+
+void BackupTask::connect()
+{
+    {
+        // Take idle session left by previous run
+        Poco::FastMutex::ScopedLock lock(_connectionsMutex);
+        std::map<unsigned, FtpClient*>::iterator it = _connections.find(_site->id);
+        if (_connections.end() != it) {
+            _ftp = it->second;
+            _connections.erase(it);
+        }
+    }
+
+    if (_ftp && _ftp->rewind())
+        writeLog("Reusing ftp connection");
+    else {
+        writeLog("Connecting to ftp server");
+        reconnect();
+    }
 }
 
 BackupTask::~BackupTask()
 {
+    delete _transfer;
+    Poco::FastMutex::ScopedLock lock(_connectionsMutex);
+    if (_keepConnections && _ftp && _connections.insert(std::make_pair(_site->id, _ftp)).second)
+        return; // session is left for the next run
     delete _ftp;
 }
 
+void BackupTask::keepConnections(bool keep)
+{
+    Poco::FastMutex::ScopedLock lock(_connectionsMutex);
+    _keepConnections = keep;
+    if (keep) return;
+
+    // Close all idle sessions
+    for (std::map<unsigned, FtpClient*>::iterator it = _connections.begin(), end = _connections.end(); it != end; ++it)
+        delete it->second;
+    _connections.clear();
+}
+
 void BackupTask::runTask()
 {
+    ASSERT_LOG(0 != _site.get()) // constructed without site
+    Tracer::Span span("task", Poco::format("site %u", _site->id));
     try {
-        if (processBatch()) return;
-
-        // Initialize ignores set
-        _ignoreOperands.clear();
-        _ignoreOperands.resize(Data::Ignore::CountOfAttributes);
-        Data::Ignore::List_t ignores = _site->ignores();
-        for (size_t i = 0, count = ignores.size(); i < count; ++i) {
-            Data::Ignore::Ptr_t ign = ignores[i];
-            if (ign->isValid())
-                _ignoreOperands[ign->attribute].insert(ign->operand);
+        connect(); // on worker thread, so sites connect in parallel
+        if (!_estimateOnly && processBatch()) {
+            _succeeded = true;
+            return;
         }
+        if (!_estimateOnly) recoverInterrupted();
+
+        _ignores.compile(_site->ignores(), _site->timePoint);
+        const std::string scanState = Poco::format("%s/%u/scanstate", backupDir(), _site->id);
+        _scan.load(scanState, _site, _site->timePoint);
 
-        // Retrieve file list from ftp server
-        Listing_t ftpFiles;
-        listFtpFiles(ftpFiles);
+        // Last committed state, database is read only if cached manifest is outdated
+        Manifest manifest;
+        loadManifest(manifest);
+        if (_estimateOnly) {
+            Lister lister(*this, 0);
+            lister.start();
+            writeLog("List files complete, found %z items", lister.count());
+            estimateChanges(lister.entries(), manifest);
+            _succeeded = true;
+            return;
+        }
 
-        // Retrieve file list from database
-        Data::File::List_t siteFiles = _site->files(); // retrieve db stored list
-        writeLog("List files complete, found %z items", ftpFiles.size());
+        // Pipeline lists site on own thread and downloads on second session meanwhile,
+        // archive is written by tar as files are stored
+        const bool pipeline = App::get().config().getBool("pipeline.enabled", false);
+        if (pipeline && !_transfer) {
+            _transfer = FtpClient::createConnect();
+            _transfer->login(_site->login, _site->password);
+            if (compressTransfers()) _transfer->enableCompression();
+        }
+        Lister lister(*this, pipeline ? std::max(1, App::get().config().getInt("pipeline.queue", 1024)) : 0);
+        lister.start(); // without pipeline listing is complete here
 
-        // Create map: file_fullName, siteFiles_index, ftpFiles_exists
-        typedef std::map<std::string, std::pair<size_t, bool> > SearchMap_t;
-        SearchMap_t search; // search by name
-        for (size_t i = 0, count = siteFiles.size(); i < count; ++i)
-            search.insert(std::make_pair(siteFiles[i]->fullName, std::make_pair(i, false)));
+        // Mirror of the last change is the base of new one
+        const Data::TimePoint_t lastChange = mirrorMode() ? _site->generation().timePoint : 0;
 
         // Prepare working directory
         Poco::File workdir(Poco::format("%s/%u/%s", backupDir(), _site->id, _timePoint));
         if (workdir.exists()) workdir.remove(true);
         workdir.createDirectories(); // create work directory
+        Journal journal(workdir.path() + ".journal");
+        // Content is not known before it is downloaded, so configured codec is used as is
+        std::auto_ptr<Archiver> archiver(pipeline && !mirrorMode() ?
+            new Archiver(workdir.path(), Codec::byName(App::config("archive.codec", "gzip"))) : 0);
 
         // Enumerate ftpFiles
-        bool hasFiles = false;
-        SearchMap_t::const_iterator send = search.end();
-        for (Listing_t::iterator it = ftpFiles.begin(), end = ftpFiles.end(); it != end; ++it)
+        bool hasFiles = false, hasErrors = false;
+        std::string signature;
+        StrList_t signatures; // new signatures to be kept after archive is created
+        std::vector<char> states(manifest.size(), EntryDeleted); // of manifest entries
+        Data::File::List_t changed; // new state of added and changed files
+        size_t added = 0, modified = 0, deleted = 0; // logged once per run
+        Changes_t changes; // for mirror
+        std::map<size_t, std::string> uniques; // unchanged entries with new unique fact
+        std::map<size_t, std::string> dates; // unchanged entries with new modify date
+        // New file like one not listed yet waits for the end of listing, it could be moved
+        // and its content is in storage then. Others are downloaded at once
+        MoveIndex moveIndex;
+        if (App::get().config().getBool("move.detect", true)) indexMoves(manifest, moveIndex);
+        Listing_t deferred;
+        bool listed = false;
+        for (Data::File::Ptr_t ftpFile; ; )
         {
-            Data::File::Ptr_t ftpFile = *it;
-            SearchMap_t::iterator sit = search.find(ftpFile->fullName);
+            // Journal keeps what is done, next run recovers it
+            if (isCancelled())
+                throw Poco::ApplicationException("Backup cancelled");
+            if (!listed && !lister.pop(ftpFile)) {
+                lister.join(); // incomplete listing would delete not listed entries
+                listed = true;
+                if (!deferred.empty()) reuseMoved(manifest, states, moveIndex, deferred);
+            }
+            if (listed) {
+                if (deferred.empty()) break;
+                ftpFile = deferred.front();
+                deferred.pop_front();
+            }
+
+            const size_t entry = manifest.find(ftpFile->fullName);
+            if (Manifest::npos == entry && !listed && !ftpFile->isDirectory &&
+                    mayBeMoved(moveIndex, states, *ftpFile)) {
+                deferred.push_back(ftpFile);
+                continue;
+            }
+            if (Manifest::npos != entry) {
+                states[entry] = EntryUnchanged; // mark that file has been processed
+                if (!ftpFile->unique.empty() && ftpFile->unique != manifest.unique(entry))
+                    uniques[entry] = ftpFile->unique;
+            }
             Poco::File fs(Poco::format("%s/%s", workdir.path(), ftpFile->fullName));
             try {
 
-                if (send == sit) { // check existense in db list
-                    writeLog("New entry discovered " + ftpFile->fullName);
+                if (Manifest::npos == entry) { // check existense in db list
+                    traceFile("New entry discovered", ftpFile->fullName);
                     // Daownload only real files
-                    if (!it->get()->isDirectory)
-                        it->get()->crc32 = _ftp->download(ftpFile->fullName, fs.path());
-                    ftpFile->setStatus(Data::File::Added);
+                    if (!ftpFile->isDirectory)
+                        ftpFile->crc32 = fetch(*ftpFile, fs.path());
+                    const Data::File::Status status = storeVersion(ftpFile, Data::File::Added, 0, fs.path(), signature);
+                    journal.stored(*ftpFile, status, signature);
+                    ftpFile->setStatus(status);
+                    journal.committed(*ftpFile);
+                    if (archiver.get() && !ftpFile->isDirectory) archiver->add(ftpFile->fullName);
+                    if (!signature.empty()) signatures.push_back(signature);
+                    changed.push_back(ftpFile);
+                    changes[ftpFile->fullName] = Data::File::Added;
+                    ++added;
                     hasFiles = true;
                 } else {
-                    Data::File::Ptr_t siteFile = siteFiles[sit->second.first];
-                    ftpFile->id = siteFile->id;
-                    if (siteFile->isDirectory != ftpFile->isDirectory) {
-                        writeLog(ftpFile->fullName + " type changed to " +
-                            (ftpFile->isDirectory ? "directory" : "file"));
+                    ftpFile->id = manifest.id(entry);
+                    if (manifest.isDirectory(entry) != ftpFile->isDirectory) {
+                        traceFile(ftpFile->isDirectory ? "Type changed to directory" : "Type changed to file",
+                            ftpFile->fullName);
                         // Daownload only real files
                         if (!ftpFile->isDirectory)
-                            ftpFile->crc32 = _ftp->download(ftpFile->fullName, fs.path());
+                            ftpFile->crc32 = fetch(*ftpFile, fs.path());
+                        storeVersion(ftpFile, Data::File::Added, 0, fs.path(), signature); // allways full
+                        journal.stored(*ftpFile, Data::File::Added, signature);
                         ftpFile->setStatus(Data::File::Modified);
+                        journal.committed(*ftpFile);
+                        if (archiver.get() && !ftpFile->isDirectory) archiver->add(ftpFile->fullName);
+                        if (!signature.empty()) signatures.push_back(signature);
+                        states[entry] = EntryChanged;
+                        changed.push_back(ftpFile);
+                        changes[ftpFile->fullName] = Data::File::Modified;
+                        ++modified;
                         hasFiles = true;
-                    } else if (!siteFile->isDirectory && siteFile->modifyDate != ftpFile->modifyDate) {
-                        writeLog("Modify date is different for file " + ftpFile->fullName);
+                    } else if (!ftpFile->isDirectory &&
+                            !manifest.sameModifyDate(entry, ftpFile->modifyDate, _listOffset)) {
+                        traceFile("Modify date is different for file", ftpFile->fullName);
                         // Download it, because modifyDate checked for real files allways
-                        ftpFile->crc32 = _ftp->download(ftpFile->fullName, fs.path());
+                        ftpFile->crc32 = fetch(*ftpFile, fs.path());
                         // Second check for mdifycation by content checksum
-                        if (siteFile->crc32 == ftpFile->crc32)
+                        if (manifest.crc32(entry) == ftpFile->crc32) {
                             fs.remove(); // skip identical files
-                        else
-                            ftpFile->setStatus(Data::File::Modified);
+                            // Listed date is stored, so the same difference is not downloaded again
+                            ftpFile->setModifyDate();
+                            dates[entry] = ftpFile->modifyDate;
+                        } else {
+                            const Data::File::Status status = storeVersion(ftpFile, Data::File::Modified,
+                                manifest.crc32(entry), fs.path(), signature);
+                            journal.stored(*ftpFile, status, signature);
+                            ftpFile->setStatus(status);
+                            journal.committed(*ftpFile);
+                            if (archiver.get()) archiver->add(ftpFile->fullName);
+                            if (!signature.empty()) signatures.push_back(signature);
+                            states[entry] = EntryChanged;
+                            changed.push_back(ftpFile);
+                            changes[ftpFile->fullName] = status;
+                            ++modified;
+                        }
                         hasFiles = true;
                     }
                 }
@@ -106,62 +628,185 @@ void BackupTask::runTask()
                 App::logger().error(
                     Poco::format("Error while processing file %s\n%s", ftpFile->fullName, ex.displayText()));
                 if (fs.exists()) fs.remove(); // delete file on any error occured
+                hasErrors = true;
             }
-
-            sit->second.second = true; // mark that file has been processed
         }
+        writeLog("List files complete, found %z items", lister.count());
 
         bool hasChanges = false;
-        // All unmarked items will be saved as deleted
-        for (SearchMap_t::const_iterator it = search.begin(); it != send; ++it)
+        // All unmarked items will be saved as deleted. Deleted directory is one tombstone,
+        // entries under it are not written, manifest order puts it before them
+        std::set<std::string> tombstones;
+        for (size_t i = 0, count = manifest.size(); i < count; ++i)
         {
-            if (it->second.second) continue; // file exists in ftp list
-            Data::File::Ptr_t siteFile = siteFiles[it->second.first];
-            writeLog("Entry has been deleted " + siteFile->fullName);
-            siteFile->setStatus(Data::File::Deleted);
+            if (EntryDeleted != states[i]) continue; // file exists in ftp list
+            const std::string fullName = manifest.fullName(i);
+            if (_scan.isSkipped(fullName)) { // directory was not listed in this run
+                states[i] = EntryUnchanged;
+                continue;
+            }
+            ++deleted;
+            if (!tombstones.empty() && isBuried(tombstones, fullName)) continue;
+
+            Data::File::Ptr_t siteFile = _site->createFile(fullName, manifest.modifyDate(i), manifest.isDirectory(i));
+            siteFile->id = manifest.id(i);
+            siteFile->crc32 = manifest.crc32(i);
+            const Data::File::Status status = siteFile->isDirectory ? Data::File::Tombstone : Data::File::Deleted;
+            if (Data::File::Tombstone == status) tombstones.insert(fullName);
+            traceFile("Entry has been deleted", fullName);
+            journal.stored(*siteFile, status, "");
+            siteFile->setStatus(status);
+            journal.committed(*siteFile);
+            changes[fullName] = status;
             hasChanges = true;
         }
+        if (App::logger().information())
+            App::logger().information(Poco::format("Site(%u) Changes: %z new, %z modified, %z deleted",
+                _site->id, added, modified, deleted));
 
         if (!hasFiles && !hasChanges)
             writeLog("All files up to date");
-        else if (hasFiles) {
-            writeLog("Creating archive " + workdir.path());
-            int result = system(Poco::format("tar --directory=\"%s\" -czf \"%s.tar.gz\" ./",
-                workdir.path(), workdir.path()).c_str());
-            if (result)
-                throw Poco::ApplicationException("tar failed", result);
+        else if (mirrorMode()) {
+            if (!changes.empty()) buildMirror(workdir.path(), _site->timePoint, changes, lastChange);
+        } else if (hasFiles) {
+            if (archiver.get())
+                archiver->finish();
+            else {
+                const Codec& codec = chooseCodec(workdir.path());
+                writeLog("Creating archive " + workdir.path() + codec.extension());
+                createArchive(workdir.path(), workdir.path(), codec);
+            }
+
+            // Stored versions are archived, next deltas are made against them
+            for (size_t i = 0, count = signatures.size(); i < count; ++i)
+                Poco::File(signatures[i]).renameTo(Poco::Path(signatures[i]).setExtension("").toString());
+            replicate(workdir.path());
         }
         workdir.remove(true);
+        Poco::File(workdir.path() + ".journal").remove(); // run is complete
+
+        // Downloads left by interrupted runs are not needed any more
+        Poco::File resume(resumeDir());
+        if (resume.exists()) resume.remove(true);
+        Poco::File resumeIndex(resumeDir() + ".index");
+        if (resumeIndex.exists()) resumeIndex.remove();
+        _resume.clear();
+
+        for (Changes_t::const_iterator it = changes.begin(), end = changes.end(); it != end; ++it)
+            _scan.changed(it->first);
+        _scan.save(scanState);
+
+        // Failed file could be written to database partially, so it is reloaded next time
+        if (hasErrors)
+            Poco::File(manifestPath(_site->id)).remove();
+        else if (!changed.empty() || hasChanges || !uniques.empty() || !dates.empty())
+            saveManifest(manifest, states, changed, uniques, dates);
+        _succeeded = !hasErrors;
 
     } catch (Poco::Exception& ex) {
         App::logger().log(ex);
     }
 }
 
-void BackupTask::restore(Data::Site::Ptr_t site, Poco::DateTime dt)
+void BackupTask::restore(Data::Site::Ptr_t site, Poco::DateTime dt, const StrList_t& filter, RestoreTask* task)
 {
     ASSERT_LOG(0 != site.get())
     App::logger().information(Poco::format("Start restoring site %u on %s",
         site->id, Poco::DateTimeFormatter::format(dt, Poco::DateTimeFormat::SORTABLE_FORMAT)));
+    const PathFilter pathFilter(filter);
+    if (!pathFilter.empty())
+        App::logger().information(Poco::format("Restoring %z paths under %s", filter.size(),
+            pathFilter.prefix().empty() ? std::string("/") : pathFilter.prefix()));
 
     // Convert local dt to UTC datetime
     std::time_t now = Poco::Timestamp().epochTime();
     dt.makeUTC(localtime(&now)->tm_gmtoff);
     Data::TimePoint_t timePoint = dt.timestamp().epochMicroseconds();
-    Data::File::List_t siteFiles = site->files(timePoint);
-    if (siteFiles.empty()) {
+
+    // Prepare working directory
+    Poco::File workdir(Poco::format("%s/%u-%?u", backupDir(), site->id, timePoint));
+    if (workdir.exists()) workdir.remove(true);
+    workdir.createDirectories();
+
+    if (!materialize(site, timePoint, workdir.path(), task, pathFilter.empty() ? 0 : &pathFilter)) {
         App::logger().information(Poco::format("No archives found on specified timepoint %?u", timePoint));
+        workdir.remove(true);
         return;
     }
 
+    Poco::Path dstpath(App::config("restore.path"));
+    App::logger().information("Uploading to ftp " + dstpath.toString());
+
+    std::auto_ptr<FtpClient> ftp(FtpClient::createConnect());
+    ftp->login(site->login, site->password);
+
+    for (int i = 0, count = dstpath.depth(); i < count; ++i)
+    {
+        const std::string& dir = dstpath[i];
+        try { ftp->createDirectory(dir); } catch (...) { }
+        ftp->setWorkingDirectory(dir);
+    }
+    ftp->removeAll(App::lastToken(workdir.path(), Poco::Path::separator()));
+    ftp->upload(workdir.path());
+    workdir.remove(true);
+}
+
+void BackupTask::compact(Data::Site::Ptr_t site)
+{
+    ASSERT_LOG(0 != site.get())
+    App::logger().information(Poco::format("Start compacting site %u", site->id));
+
+    const int days = App::get().config().getInt("retention.days", 0);
+    const Data::TimePoint_t cutoff = Poco::Timestamp().epochMicroseconds() -
+        Data::TimePoint_t(days) * 86400 * Poco::Timestamp::resolution();
+    if (mirrorMode()) { // every mirror is full already
+        if (days > 0) pruneMirrors(site, cutoff);
+        return;
+    }
+
+    Poco::File workdir(Poco::format("%s/%u-compact", backupDir(), site->id));
+    if (workdir.exists()) workdir.remove(true);
+    workdir.createDirectories();
+
+    // Site state after the last change becomes one full archive
+    std::vector<Data::TimePoint_t> snapshots = site->snapshots();
+    const Data::TimePoint_t snapshot = materialize(site, Poco::Timestamp().epochMicroseconds(), workdir.path());
+    if (!snapshot || (!snapshots.empty() && snapshots.back() >= snapshot))
+        App::logger().information(Poco::format("Site %u snapshot is up to date", site->id));
+    else {
+        const std::string archive = snapshotPath(site->id, snapshot);
+        const Codec& codec = chooseCodec(workdir.path());
+        App::logger().information("Creating snapshot " + archive + codec.extension());
+        createArchive(workdir.path(), archive, codec);
+        replicate(archive);
+        site->addSnapshot(snapshot);
+        snapshots.push_back(snapshot);
+    }
+    workdir.remove(true);
+
+    // Restore points older than retention period are not kept
+    if (days > 0)
+        collectGarbage(site, snapshots, cutoff);
+}
+
+Data::TimePoint_t BackupTask::materialize(Data::Site::Ptr_t site, Data::TimePoint_t timePoint, const std::string& dir,
+                                          RestoreTask* task, const PathFilter* filter)
+{
+    // Filter narrows the query by prefix, archives without selected files are not opened
+    Data::File::List_t siteFiles = site->files(timePoint, filter ? filter->prefix() : std::string());
+    if (siteFiles.empty()) return 0;
+
     // Create map File::fullName => (File::modifyDate, i)
     // Store here only files with greatest File::modifyDate values
     typedef std::map<std::string, std::pair<Data::TimePoint_t, size_t> > Files_t;
     Files_t files;
+    Data::TimePoint_t last = 0;
     for (size_t i = 0, count = siteFiles.size(); i < count; ++i) {
         Data::File::Ptr_t file = siteFiles[i];
+        if (filter && !filter->match(file->fullName)) continue;
         Data::TimePoint_t tp = Poco::NumberParser::parse64(file->modifyDate);
         Files_t::iterator it = files.find(file->fullName);
+        last = std::max(last, tp);
 
         if (files.end() == it)
             files[file->fullName] = std::make_pair(tp, i);
@@ -171,66 +816,735 @@ void BackupTask::restore(Data::Site::Ptr_t site, Poco::DateTime dt)
         }
     }
 
+    if (files.empty()) return 0;
+
+    // Newest mirror up to timePoint is the whole state, files in last are filtered ones only and
+    // older mirrors are pruned. Archive storage takes it only if no change came after it
+    Data::TimePoint_t mirrorTp = 0;
+    const std::vector<Data::TimePoint_t> snapshotMirrors = mirrors(site->id);
+    for (size_t i = 0, count = snapshotMirrors.size(); i < count && snapshotMirrors[i] <= timePoint; ++i)
+        mirrorTp = snapshotMirrors[i];
+    if (mirrorTp && (mirrorMode() || mirrorTp >= last)) {
+        Poco::File mirror(mirrorPath(site->id, mirrorTp));
+        App::logger().information("Linking mirror " + mirror.path());
+        if (!filter) {
+            Poco::File(dir).remove(true);
+            linkTree(mirror.path(), dir);
+        } else for (Files_t::const_iterator it = files.begin(), end = files.end(); it != end; ++it) {
+            Data::File::Ptr_t file = siteFiles[it->second.second];
+            if (file->isDeleted()) continue;
+            Poco::File dst(dir + it->first);
+            if (file->isDirectory)
+                dst.createDirectories();
+            else {
+                Poco::File(Poco::Path(dst.path()).parent()).createDirectories();
+                if (link((mirror.path() + it->first).c_str(), dst.path().c_str()))
+                    throw Poco::FileException("Unable to link " + dst.path());
+            }
+        }
+        reportProgress(task, 1);
+        return std::max(last, mirrorTp);
+    }
+
+    // Latest synthetic full archive, all versions up to it are taken from there
+    Data::TimePoint_t snapshot = 0;
+    std::vector<Data::TimePoint_t> snapshots = site->snapshots();
+    for (size_t i = 0, count = snapshots.size(); i < count && snapshots[i] <= timePoint; ++i)
+        snapshot = snapshots[i];
+
     // Group files by archive name (File::modifyDate) and skip deleted
     typedef std::map<Data::TimePoint_t, Listing_t> Archives_t;
-    Archives_t archives;
+    Archives_t archives, patches;
+    // Deltas to apply by file name in order of creation
+    typedef std::map<std::string, std::vector<Data::TimePoint_t> > Chains_t;
+    Chains_t chains;
     size_t total = 0; // files count minus skipped items
     for (Files_t::const_iterator it = files.begin(), end = files.end(); it != end; ++it)
     {
         Data::File::Ptr_t file = siteFiles[it->second.second];
         if (file->isDeleted()) continue; // skip deleted files
-        archives[it->second.first].push_back(file);
+
+        Data::TimePoint_t tp = it->second.first;
+        if (file->isDelta() && tp > snapshot) { // go back to the last full version
+            Data::File::Version::List_t versions = file->versions(tp);
+            std::vector<Data::TimePoint_t>& chain = chains[file->fullName];
+            size_t i = 0;
+            for (size_t count = versions.size(); i < count && Data::File::Delta == versions[i].status &&
+                 versions[i].timePoint > snapshot; ++i) {
+                chain.insert(chain.begin(), versions[i].timePoint);
+                patches[versions[i].timePoint].push_back(file);
+            }
+            if (versions.size() == i)
+                throw Poco::DataFormatException("No full version found for " + file->fullName);
+            tp = versions[i].timePoint;
+        }
+        archives[tp > snapshot ? tp : snapshot].push_back(file);
         ++total;
     }
 
-    // Prepare working directory
-    std::string bdir = backupDir();
-    Poco::File workdir(Poco::format("%s/%u-%?u", bdir, site->id, timePoint));
-    if (workdir.exists()) workdir.remove(true);
-    workdir.createDirectories();
-
-    // Extract files to workdir
+    // Extract files to dir, deltas of each archive go to own directory
     App::logger().information(Poco::format("Extracting %z files from %z archives", total, archives.size()));
-    for (Archives_t::const_iterator ait = archives.begin(), aend = archives.end(); ait != aend; ++ait)
+    Poco::File deltadir(dir + ".delta");
+    ExtractJobs_t jobs;
+    for (Archives_t::const_iterator ait = archives.begin(), aend = archives.end(); ait != aend; ++ait) {
+        ExtractJob job = { ait->first == snapshot ? snapshotPath(site->id, snapshot)
+                                                  : archivePath(site->id, ait->first), dir, &ait->second };
+        jobs.push_back(job);
+    }
+    for (Archives_t::const_iterator pit = patches.begin(), pend = patches.end(); pit != pend; ++pit) {
+        ExtractJob job = { archivePath(site->id, pit->first),
+                           Poco::format("%s/%?u", deltadir.path(), pit->first), &pit->second };
+        jobs.push_back(job);
+    }
+    extractAll(jobs, task);
+
+    if (!chains.empty()) {
+        // Deltas are applied in order of creation
+        App::logger().information(Poco::format("Applying deltas to %z files", chains.size()));
+        for (Chains_t::const_iterator cit = chains.begin(), cend = chains.end(); cit != cend; ++cit)
+        {
+            const std::string path = dir + cit->first;
+            for (size_t i = 0, count = cit->second.size(); i < count; ++i) {
+                BinaryDelta::patch(path, Poco::format("%s/%?u%s", deltadir.path(), cit->second[i], cit->first),
+                                   path + ".patched");
+                Poco::File(path + ".patched").renameTo(path);
+            }
+        }
+        deltadir.remove(true);
+    }
+    return last;
+}
+
+void BackupTask::collectGarbage(Data::Site::Ptr_t site, const std::vector<Data::TimePoint_t>& snapshots,
+                                Data::TimePoint_t cutoff)
+{
+    // Restore after cutoff needs nothing older than the last snapshot before it
+    Data::TimePoint_t base = 0;
+    for (size_t i = 0, count = snapshots.size(); i < count && snapshots[i] <= cutoff; ++i)
+        base = snapshots[i];
+    if (!base) return;
+
+    // Archive name is <timePoint>[.full]<codec extension>
+    StrList_t superseded;
+    for (Poco::DirectoryIterator dit(Poco::format("%s/%u", backupDir(), site->id)), end; dit != end; ++dit)
+    {
+        const std::string& name = dit.name();
+        const size_t pos = name.find('.');
+        Poco::Int64 tp;
+        if (std::string::npos == pos || !Poco::NumberParser::tryParse64(name.substr(0, pos), tp) ||
+                0 == name.compare(pos, std::string::npos, ".journal")) // run to be recovered
+            continue;
+        const bool full = 0 == name.compare(pos, 5, ".full");
+        if (tp < base || (tp == base && !full))
+            superseded.push_back(dit->path());
+    }
+
+    for (size_t i = 0, count = superseded.size(); i < count; ++i) {
+        App::logger().information("Removing superseded archive " + superseded[i]);
+        Poco::File(superseded[i]).remove();
+    }
+    for (size_t i = 0, count = snapshots.size(); i < count && snapshots[i] < base; ++i)
+        site->delSnapshot(snapshots[i]);
+}
+
+void BackupTask::verify(Data::Site::Ptr_t site)
+{
+    ASSERT_LOG(0 != site.get())
+    App::logger().information(Poco::format("Start verifying site %u", site->id));
+
+    // Archives are not changed after creation, so they are read again only after verify.interval days
+    const Poco::Timestamp now;
+    const std::set<std::string> verified = site->verifiedArchives(now.epochMicroseconds() -
+        Data::TimePoint_t(App::get().config().getInt("verify.interval", 30)) * 86400 * Poco::Timestamp::resolution());
+
+    // Archive name is <timePoint>[.full]<codec extension>
+    Verifier::Jobs_t jobs;
+    const std::string siteDir = Poco::format("%s/%u", backupDir(), site->id);
+    if (!Poco::File(siteDir).exists()) return;
+    for (Poco::DirectoryIterator dit(siteDir), end; dit != end; ++dit)
+    {
+        const std::string& name = dit.name();
+        const size_t pos = name.find('.');
+        Poco::Int64 tp;
+        if (std::string::npos == pos || !dit->isFile() || !Poco::NumberParser::tryParse64(name.substr(0, pos), tp))
+            continue;
+        const bool full = 0 == name.compare(pos, 5, ".full");
+        const std::string archive = name.substr(0, full ? pos + 5 : pos);
+        const Codec* codec = Codec::byArchive(siteDir + "/" + archive);
+        if (!codec || name != archive + codec->extension() || verified.count(archive)) continue;
+
+        Verifier::Job job;
+        job.archive = archive;
+        job.path = siteDir + "/" + archive;
+        job.timePoint = tp;
+        job.full = full;
+        job.members = job.bad = 0;
+        jobs.push_back(job);
+    }
+    if (jobs.empty()) {
+        App::logger().information(Poco::format("Site %u archives are verified already", site->id));
+        return;
+    }
+
+    // Current thread is one of workers
+    const Data::StoredVersion::Map_t stored = site->storedVersions();
+    Verifier verifier(jobs, stored);
+    const size_t threads = std::min<size_t>(jobs.size(),
+        std::max(1, App::get().config().getInt("verify.threads", 4)));
+    std::vector<Poco::SharedPtr<Poco::Thread> > workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.push_back(new Poco::Thread);
+        workers.back()->start(verifier);
+    }
+    verifier.run();
+    for (size_t i = 0, count = workers.size(); i < count; ++i)
+        workers[i]->join();
+
+    // Results are recorded, damaged files are scheduled for download
+    std::set<unsigned> damaged;
+    size_t members = 0, failed = 0;
+    for (size_t i = 0, count = jobs.size(); i < count; ++i) {
+        const Verifier::Job& job = jobs[i];
+        site->addVerification(job.archive, now.epochMicroseconds(), job.members, job.bad, job.error);
+        members += job.members;
+        if (!job.error.empty() || job.bad) {
+            ++failed;
+            App::logger().error(Poco::format("Site %u archive %s: %u damaged members%s", site->id, job.archive,
+                job.bad, job.error.empty() ? std::string() : ", " + job.error));
+        }
+        damaged.insert(job.damaged.begin(), job.damaged.end());
+    }
+    for (std::set<unsigned>::const_iterator it = damaged.begin(), end = damaged.end(); it != end; ++it)
+        site->invalidateFile(*it);
+    if (!damaged.empty()) {
+        Poco::File manifest(manifestPath(site->id)); // cached state has old checksums
+        if (manifest.exists()) manifest.remove();
+    }
+    App::logger().information(Poco::format("Site %u verified %z archives, %z members: %z damaged archives, "
+        "%z files to download again", site->id, jobs.size(), members, failed, damaged.size()));
+}
+
+void BackupTask::createArchive(const std::string& dir, const std::string& archive, const Codec& codec,
+                               const std::string& fileList)
+{
+    Poco::File part(archive + ".part" + codec.extension());
+    if (part.exists()) part.remove(); // left by crashed run
+    const std::string members = fileList.empty() ? std::string("./") : "--files-from=\"" + fileList + "\"";
+    int result = system(Poco::format("tar --directory=\"%s\" %s -cf \"%s\" %s",
+        dir, codec.tarOption(), part.path(), members).c_str());
+    if (result) {
+        if (part.exists()) part.remove();
+        throw Poco::ApplicationException("tar failed", result);
+    }
+    part.renameTo(archive + codec.extension());
+}
+
+bool BackupTask::mirrorMode()
+{
+    return "mirror" == App::config("storage.mode", "archive");
+}
+
+void BackupTask::buildMirror(const std::string& workdir, Data::TimePoint_t tp, const Changes_t& changes,
+                             Data::TimePoint_t base)
+{
+    const std::string target = mirrorPath(_site->id, tp);
+    Poco::File tmp(target + ".tmp"); // renamed when complete
+    if (tmp.exists()) tmp.remove(true);
+    Poco::File(Poco::Path(target).parent()).createDirectories();
+
+    // Unchanged files are links to previous mirror, state is built from archives if it is missing
+    if (base && Poco::File(mirrorPath(_site->id, base)).exists())
+        linkTree(mirrorPath(_site->id, base), tmp.path());
+    else {
+        writeLog("No mirror of previous state, building it");
+        tmp.createDirectories();
+        materialize(_site, tp - 1, tmp.path());
+    }
+
+    // Parents come before children in map order
+    writeLog("Creating mirror " + target);
+    for (Changes_t::const_iterator it = changes.begin(), end = changes.end(); it != end; ++it)
     {
-        // List files to be extracted
-        Poco::File flist(Poco::format("%s/%?u.flist", bdir, ait->first));
-        Poco::FileOutputStream fos(flist.path()); // save list of fullNames to file on disk
-        for (Listing_t::const_iterator fit = ait->second.begin(), fend = ait->second.end(); fit != fend; ++fit)
+        Poco::File dst(tmp.path() + it->first);
+        if (Data::File::Deleted == it->second || Data::File::Tombstone == it->second) {
+            if (dst.exists()) dst.remove(true);
+            continue;
+        }
+
+        // Only files are stored in workdir, directories are created
+        Poco::File src(workdir + it->first);
+        if (src.exists() && src.isFile()) {
+            if (dst.exists()) dst.remove(true); // link is shared with older mirrors, never written through
+            Poco::File(Poco::Path(dst.path()).parent()).createDirectories();
+            src.renameTo(dst.path());
+        } else {
+            if (dst.exists() && !dst.isDirectory()) dst.remove();
+            dst.createDirectories();
+        }
+    }
+    tmp.renameTo(target);
+}
+
+std::vector<Data::TimePoint_t> BackupTask::mirrors(unsigned siteId)
+{
+    std::vector<Data::TimePoint_t> result;
+    Poco::File root(Poco::format("%s/%u/mirror", backupDir(), siteId));
+    if (!root.exists()) return result;
+
+    // Mirror being built has .tmp suffix and is not parsed
+    for (Poco::DirectoryIterator dit(root), end; dit != end; ++dit) {
+        Poco::Int64 tp;
+        if (Poco::NumberParser::tryParse64(dit.name(), tp)) result.push_back(tp);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void BackupTask::pruneMirrors(Data::Site::Ptr_t site, Data::TimePoint_t cutoff)
+{
+    const std::vector<Data::TimePoint_t> existing = mirrors(site->id);
+
+    // The last mirror before cutoff is kept, restore after cutoff may need it
+    for (size_t i = 0, count = existing.size(); i + 1 < count && existing[i + 1] <= cutoff; ++i) {
+        const std::string path = mirrorPath(site->id, existing[i]);
+        App::logger().information("Removing superseded mirror " + path);
+        Poco::File(path).remove(true);
+    }
+}
+
+void BackupTask::linkTree(const std::string& src, const std::string& dst)
+{
+    int result = system(Poco::format("cp -al \"%s\" \"%s\"", src, dst).c_str());
+    if (result)
+        throw Poco::ApplicationException("cp failed", result);
+}
+
+void BackupTask::extractAll(const ExtractJobs_t& jobs, RestoreTask* task)
+{
+    const size_t threads = std::min<size_t>(jobs.size(),
+        std::max(1, App::get().config().getInt("restore.threads", 4)));
+    Extractor extractor(jobs, task);
+
+    // Directories are made before workers start, they are shared by jobs
+    for (size_t i = 0, count = jobs.size(); i < count; ++i) {
+        Poco::File(jobs[i].dir).createDirectories();
+        const Listing_t& files = *jobs[i].files;
+        for (Listing_t::const_iterator fit = files.begin(), fend = files.end(); fit != fend; ++fit)
+            if ((*fit)->isDirectory) Poco::File(jobs[i].dir + (*fit)->fullName).createDirectories();
+    }
+
+    // Current thread is one of workers
+    std::vector<Poco::SharedPtr<Poco::Thread> > workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.push_back(new Poco::Thread);
+        workers.back()->start(extractor);
+    }
+    extractor.run();
+    for (size_t i = 0, count = workers.size(); i < count; ++i)
+        workers[i]->join();
+
+    if (!extractor.error().empty())
+        throw Poco::ApplicationException("Extraction failed, " + extractor.error());
+    if (task && task->isCancelled())
+        throw Poco::ApplicationException("Extraction cancelled");
+}
+
+void BackupTask::reportProgress(RestoreTask* task, float progress)
+{
+    if (task) task->setProgress(progress);
+}
+
+void BackupTask::extract(const std::string& archive, const Listing_t& files, const std::string& dir)
+{
+    // Member names are stored relative to archive root, directories are made by extractAll()
+    std::set<std::string> names;
+    for (Listing_t::const_iterator fit = files.begin(), fend = files.end(); fit != fend; ++fit)
+        if (!(*fit)->isDirectory) names.insert('.' + (*fit)->fullName);
+    if (names.empty()) return;
+
+    // Archive removed from this host is taken back from replica
+    const Codec* codec = Codec::byArchive(archive);
+    if (!codec && Replicator::fetch(archive))
+        codec = Codec::byArchive(archive);
+    if (!codec)
+        throw Poco::NotFoundException("Archive not found " + archive);
+
+    if (ArchiveReader::supports(*codec)) {
+        ArchiveReader reader(archive + codec->extension(), *codec);
+        const size_t found = reader.extract(names, dir);
+        if (found != names.size())
+            throw Poco::NotFoundException(Poco::format("%z of %z files not found in archive %s%s",
+                names.size() - found, names.size(), archive, codec->extension()));
+        return;
+    }
+
+    // No built in decoder, pass list of fullNames to tar
+    Poco::TemporaryFile flist;
+    Poco::FileOutputStream fos(flist.path());
+    for (std::set<std::string>::const_iterator it = names.begin(), end = names.end(); it != end; ++it)
+        fos << *it << std::endl;
+    fos.close();
+
+    int result = system(Poco::format("tar --directory=\"%s\" --files-from=\"%s\" %s -xf \"%s%s\"",
+                    dir, flist.path(), codec->tarOption(), archive, codec->extension()).c_str());
+    if (result)
+        throw Poco::ApplicationException("tar exit with error, aborting...", result);
+}
+
+void BackupTask::recoverInterrupted()
+{
+    Poco::File siteDir(Poco::format("%s/%u", backupDir(), _site->id));
+    if (!siteDir.exists()) return;
+
+    // Journal <timePoint>.journal is left next to working directory of interrupted run
+    StrList_t journals;
+    for (Poco::DirectoryIterator dit(siteDir), end; dit != end; ++dit)
+        if ("journal" == Poco::Path(dit.name()).getExtension())
+            journals.push_back(dit.name());
+    std::sort(journals.begin(), journals.end());
+
+    for (size_t i = 0, count = journals.size(); i < count; ++i) {
+        const std::string timePoint = Poco::Path(journals[i]).getBaseName();
+        const std::string journalPath = siteDir.path() + "/" + journals[i];
+        Poco::File workdir(siteDir.path() + "/" + timePoint);
+        writeLog("Finishing interrupted run " + timePoint);
+
+        Journal::Record::Map_t records;
+        Journal::read(journalPath, records);
+        Journal resume(resumeDir() + ".index");
+
+        // Committed files go to archive of that run, others are kept for reuse.
+        // Files without record were not downloaded completely and are dropped.
+        Poco::TemporaryFile flist;
+        Poco::FileOutputStream fos(flist.path());
+        StrList_t committedSignatures;
+        Changes_t changes; // committed, for mirror
+        bool hasFiles = false;
+        for (Journal::Record::Map_t::const_iterator it = records.begin(), end = records.end(); it != end; ++it)
         {
-            Data::File::Ptr_t file = *fit;
-            if (!file->isDirectory)
-                fos << '.' << file->fullName << std::endl;
-            else
-                Poco::File(workdir.path() + file->fullName).createDirectories();
+            const Journal::Record& rec = it->second;
+            Poco::File file(workdir.path() + it->first);
+            const bool isFile = file.exists() && file.isFile();
+            if (rec.committed) {
+                changes[it->first] = rec.status;
+                if (isFile) {
+                    fos << '.' << it->first << std::endl;
+                    hasFiles = true;
+                }
+                if (!rec.signature.empty()) committedSignatures.push_back(rec.signature);
+                continue;
+            }
+
+            // Database does not know this version, its signature is not valid
+            if (!rec.signature.empty() && Poco::File(rec.signature).exists())
+                Poco::File(rec.signature).remove();
+            if (!isFile || Data::File::Delta == rec.status) continue; // delta content is not reusable
+
+            Poco::File cached(resumeDir() + it->first);
+            Poco::File(Poco::Path(cached.path()).parent()).createDirectories();
+            file.renameTo(cached.path());
+            Data::File::Ptr_t stored = _site->createFile(it->first, rec.modifyDate, false);
+            stored->crc32 = rec.crc32;
+            resume.stored(*stored, rec.status, "");
         }
         fos.close();
 
-        if (0 != flist.getSize()) {
-            int result = system(Poco::format("tar --directory=\"%s\" --files-from=\"%s\" -xf \"%s/%u/%?u.tar.gz\"",
-                            workdir.path(), flist.path(), bdir, site->id, ait->first).c_str());
-            if (result)
-                throw Poco::ApplicationException("tar exit with error, aborting...", result);
+        // Archive is complete only under its final name, partial one is built again
+        const std::string archive = workdir.path(); // as runTask() names it
+        const Codec* part = Codec::byArchive(archive + ".part");
+        if (part) Poco::File(archive + ".part" + part->extension()).remove();
+        if (mirrorMode()) {
+            const Data::TimePoint_t tp = Poco::NumberParser::parse64(timePoint);
+            if (!changes.empty() && !Poco::File(mirrorPath(_site->id, tp)).exists())
+                buildMirror(workdir.path(), tp, changes, 0);
+        } else if (hasFiles && !Codec::byArchive(archive)) {
+            const Codec& codec = chooseCodec(workdir.path());
+            writeLog("Creating archive " + archive + codec.extension());
+            createArchive(workdir.path(), archive, codec, flist.path());
+            replicate(archive);
         }
-                    ;
-        flist.remove();
+        for (size_t j = 0, scount = committedSignatures.size(); j < scount; ++j)
+            if (Poco::File(committedSignatures[j]).exists())
+                Poco::File(committedSignatures[j]).renameTo(
+                    Poco::Path(committedSignatures[j]).setExtension("").toString());
+
+        if (workdir.exists()) workdir.remove(true);
+        Poco::File(journalPath).remove();
     }
 
-    Poco::Path dstpath(App::config("restore.path"));
-    App::logger().information("Uploading to ftp " + dstpath.toString());
+    _resume.clear();
+    Journal::read(resumeDir() + ".index", _resume);
+}
 
-    std::auto_ptr<FtpClient> ftp(FtpClient::createConnect());
-    ftp->login(site->login, site->password);
+unsigned BackupTask::fetch(const Data::File& file, const std::string& path)
+{
+    // Same version left by interrupted run is taken if its content is intact
+    Journal::Record::Map_t::iterator it = _resume.find(file.fullName);
+    if (_resume.end() != it) {
+        Poco::File cached(resumeDir() + file.fullName);
+        const unsigned crc32 = it->second.crc32;
+        const bool same = it->second.modifyDate == file.modifyDate && cached.exists() &&
+            fileCrc32(cached.path()) == crc32;
+        _resume.erase(it);
+        if (same) {
+            Poco::File(Poco::Path(path).parent()).createDirectories();
+            cached.renameTo(path);
+            traceFile("Reused stored content", file.fullName);
+            return crc32;
+        }
+    }
+    return (_transfer ? _transfer : _ftp)->download(file.fullName, path);
+}
 
-    for (int i = 0, count = dstpath.depth(); i < count; ++i)
+void BackupTask::indexMoves(const Manifest& manifest, MoveIndex& index)
+{
+    for (size_t i = 0, count = manifest.size(); i < count; ++i) {
+        if (manifest.isDirectory(i)) continue;
+        const std::string unique = manifest.unique(i);
+        if (!unique.empty()) index.byUnique[unique] = i;
+        index.byDate.insert(std::make_pair(manifest.modifyDate(i), i));
+    }
+}
+
+bool BackupTask::mayBeMoved(const MoveIndex& index, const std::vector<char>& states, const Data::File& file)
+{
+    std::map<std::string, size_t>::const_iterator uit = index.byUnique.find(file.unique);
+    if (!file.unique.empty() && index.byUnique.end() != uit && EntryDeleted == states[uit->second])
+        return true;
+    typedef std::multimap<std::string, size_t>::const_iterator DateIt_t;
+    const std::pair<DateIt_t, DateIt_t> range = index.byDate.equal_range(file.modifyDate);
+    for (DateIt_t dit = range.first; dit != range.second; ++dit)
+        if (EntryDeleted == states[dit->second]) return true;
+    return false;
+}
+
+void BackupTask::reuseMoved(const Manifest& manifest, const std::vector<char>& states, const MoveIndex& index,
+                            const Listing_t& added)
+{
+    // Disappeared files are candidates, entry of directory not listed in this run is not
+    std::vector<bool> used(manifest.size());
+    for (size_t i = 0, count = manifest.size(); i < count; ++i)
+        used[i] = EntryDeleted != states[i] || _scan.isSkipped(manifest.fullName(i));
+
+    // Same unique fact is the same file, otherwise server checksum must match stored one
+    typedef std::map<std::string, std::pair<size_t, std::string> > Moves_t; // new name => (entry, modify date)
+    Moves_t moves;
+    for (Listing_t::const_iterator it = added.begin(), end = added.end(); it != end; ++it) {
+        const Data::File& file = **it;
+        if (_resume.count(file.fullName)) continue; // left by interrupted run
+        size_t from = Manifest::npos;
+        std::map<std::string, size_t>::const_iterator uit = index.byUnique.find(file.unique);
+        if (!file.unique.empty() && index.byUnique.end() != uit && !used[uit->second] &&
+                manifest.sameModifyDate(uit->second, file.modifyDate, _listOffset))
+            from = uit->second;
+
+        typedef std::multimap<std::string, size_t>::const_iterator DateIt_t;
+        const std::pair<DateIt_t, DateIt_t> range = index.byDate.equal_range(file.modifyDate);
+        bool candidate = false;
+        for (DateIt_t dit = range.first; dit != range.second && !candidate; ++dit)
+            candidate = !used[dit->second];
+        unsigned crc32;
+        if (Manifest::npos == from && candidate && _ftp->checksum(file.fullName, crc32))
+            for (DateIt_t dit = range.first; dit != range.second; ++dit)
+                if (!used[dit->second] && manifest.crc32(dit->second) == crc32) {
+                    from = dit->second;
+                    break;
+                }
+        if (Manifest::npos == from) continue;
+        used[from] = true;
+        moves[file.fullName] = std::make_pair(from, file.modifyDate);
+    }
+    if (moves.empty()) return;
+    writeLog("Found %z moved files, their content is taken from storage", moves.size());
+
+    // Old versions are restored under old names and wait in resume directory under new ones,
+    // fetch() checks their crc32, so any mismatch is downloaded
+    std::set<std::string> names;
+    for (Moves_t::const_iterator it = moves.begin(), end = moves.end(); it != end; ++it)
+        names.insert(manifest.fullName(it->second.first));
+    const PathFilter filter(names);
+    Poco::File tmp(resumeDir() + ".moved");
+    if (tmp.exists()) tmp.remove(true);
+    tmp.createDirectories();
+    try {
+        materialize(_site, _site->timePoint - 1, tmp.path(), 0, &filter); // without this run
+        for (Moves_t::const_iterator it = moves.begin(), end = moves.end(); it != end; ++it) {
+            const size_t from = it->second.first;
+            Poco::File src(tmp.path() + manifest.fullName(from));
+            if (!src.exists() || !src.isFile()) continue;
+            Poco::File cached(resumeDir() + it->first);
+            Poco::File(Poco::Path(cached.path()).parent()).createDirectories();
+            src.renameTo(cached.path());
+
+            Journal::Record& rec = _resume[it->first];
+            rec.committed = false;
+            rec.status = Data::File::Added;
+            rec.crc32 = manifest.crc32(from);
+            rec.modifyDate = it->second.second;
+            traceFile("Entry moved from " + manifest.fullName(from), it->first);
+        }
+    } catch (Poco::Exception& ex) {
+        App::logger().warning("Unable to take moved files from storage, downloading them\n" + ex.displayText());
+    }
+    tmp.remove(true);
+}
+
+void BackupTask::replicate(const std::string& archive)
+{
+    const Codec* codec = Codec::byArchive(archive);
+    if (codec) Replicator::push(archive + codec->extension());
+}
+
+std::string BackupTask::resumeDir() const
+{
+    return Poco::format("%s/%u/resume", backupDir(), _site->id);
+}
+
+bool BackupTask::isBuried(const std::set<std::string>& tombstones, const std::string& fullName)
+{
+    for (size_t pos = fullName.rfind('/'); pos && std::string::npos != pos; pos = fullName.rfind('/', pos - 1))
+        if (tombstones.count(fullName.substr(0, pos))) return true;
+    return false;
+}
+
+void BackupTask::loadManifest(Manifest& manifest)
+{
+    const std::string path = manifestPath(_site->id);
+    const Data::Generation generation = _site->generation();
+    if (manifest.open(path, generation)) {
+        writeLog("Using cached manifest of %z files", manifest.size());
+        return;
+    }
+
+    writeLog("Loading file list from database");
+    Manifest::Record::List_t records;
+    Manifest::toRecords(_site->files(), records);
+    Poco::File(Poco::Path(path).parent()).createDirectories();
+    Manifest::write(path, generation, records);
+    if (!manifest.open(path, generation))
+        throw Poco::IllegalStateException("Unable to open manifest " + path);
+}
+
+void BackupTask::estimateChanges(const Listing_t& ftpFiles, const Manifest& manifest)
+{
+    // Same decisions as runTask() makes, but nothing is downloaded or written
+    std::vector<bool> listed(manifest.size(), false);
+    for (Listing_t::const_iterator it = ftpFiles.begin(), end = ftpFiles.end(); it != end; ++it)
     {
-        const std::string& dir = dstpath[i];
-        try { ftp->createDirectory(dir); } catch (...) { }
-        ftp->setWorkingDirectory(dir);
+        const Data::File& file = **it;
+        const size_t entry = manifest.find(file.fullName);
+        if (Manifest::npos == entry)
+            ++_estimate.added;
+        else {
+            listed[entry] = true;
+            if (manifest.isDirectory(entry) == file.isDirectory &&
+                    (file.isDirectory || manifest.sameModifyDate(entry, file.modifyDate, _listOffset)))
+                continue;
+            ++_estimate.modified;
+        }
+        if (!file.isDirectory) _estimate.bytes += file.size;
     }
-    ftp->removeAll(App::lastToken(workdir.path(), Poco::Path::separator()));
-    ftp->upload(workdir.path());
-    workdir.remove(true);
+    for (size_t i = 0, count = listed.size(); i < count; ++i)
+        if (!listed[i] && !_scan.isSkipped(manifest.fullName(i))) ++_estimate.deleted;
+
+    App::logger().information(Poco::format("Site(%u) Estimate: %z new, %z modified, %z deleted, %s to download",
+        _site->id, _estimate.added, _estimate.modified, _estimate.deleted, formatBytes(_estimate.bytes)));
+}
+
+std::string BackupTask::formatBytes(Poco::UInt64 bytes)
+{
+    return Poco::format("%.1f MB", double(bytes) / (1 << 20));
+}
+
+void BackupTask::saveManifest(const Manifest& manifest, const std::vector<char>& states,
+                              const Data::File::List_t& changed, const std::map<size_t, std::string>& uniques,
+                              const std::map<size_t, std::string>& dates)
+{
+    Manifest::Record::List_t records;
+    Manifest::toRecords(changed, records);
+    records.reserve(records.size() + manifest.size());
+    for (size_t i = 0, count = manifest.size(); i < count; ++i) {
+        if (EntryUnchanged != states[i]) continue;
+        records.push_back(Manifest::Record());
+        manifest.toRecord(i, records.back());
+        std::map<size_t, std::string>::const_iterator it = uniques.find(i);
+        if (uniques.end() != it) records.back().unique = it->second;
+        it = dates.find(i);
+        if (dates.end() != it) records.back().modifyDate = it->second;
+    }
+    Manifest::write(manifestPath(_site->id), _site->generation(), records);
+}
+
+std::string BackupTask::manifestPath(unsigned siteId)
+{
+    return Poco::format("%s/%u/manifest", backupDir(), siteId);
+}
+
+std::string BackupTask::archivePath(unsigned siteId, Data::TimePoint_t tp)
+{
+    return Poco::format("%s/%u/%?u", backupDir(), siteId, tp);
+}
+
+std::string BackupTask::snapshotPath(unsigned siteId, Data::TimePoint_t tp)
+{
+    return archivePath(siteId, tp) + ".full";
+}
+
+std::string BackupTask::mirrorPath(unsigned siteId, Data::TimePoint_t tp)
+{
+    return Poco::format("%s/%u/mirror/%?u", backupDir(), siteId, tp);
+}
+
+const Codec& BackupTask::chooseCodec(const std::string& dir)
+{
+    const Codec& codec = Codec::byName(App::config("archive.codec", "gzip"));
+    if (&Codec::none() == &codec) return codec;
+
+    std::set<std::string> skipExt;
+    Poco::StringTokenizer tok(Poco::toLower(App::config("archive.skipExt")), ",",
+        Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+    skipExt.insert(tok.begin(), tok.end());
+
+    Poco::UInt64 total = 0, compressible = 0;
+    measureCompressible(Poco::File(dir), skipExt,
+        App::get().config().getDouble("archive.maxEntropy", 7.5), total, compressible);
+
+    // Do not spend cpu when most of content will not shrink
+    if (total && compressible < total * App::get().config().getDouble("archive.minCompressible", 0.2)) {
+        App::logger().information("Content is not compressible, compression skipped for " + dir);
+        return Codec::none();
+    }
+    return codec;
+}
+
+Data::File::Status BackupTask::storeVersion(Data::File::Ptr_t file, Data::File::Status status,
+    unsigned baseCrc32, const std::string& path, std::string& signature)
+{
+    signature.clear();
+    if (!_deltaEnabled || file->isDirectory || Poco::File(path).getSize() < _deltaMinSize)
+        return status;
+
+    const std::string sig = Poco::format("%s/%u/signatures%s.sig", backupDir(), _site->id, file->fullName);
+    Poco::File(Poco::Path(sig).parent()).createDirectories();
+    signature = sig + ".new";
+
+    // Delta is made only against signature of the last stored version
+    unsigned chain = 0, crc32 = 0;
+    if (Data::File::Modified == status && BinaryDelta::header(sig, chain, crc32) &&
+        baseCrc32 == crc32 && chain < _deltaChain)
+    {
+        const std::string delta = path + ".delta";
+        if (BinaryDelta::encode(sig, path, delta) < Poco::File(path).getSize() / 2) {
+            BinaryDelta::signature(path, signature, _deltaBlock, chain + 1, file->crc32);
+            Poco::File(delta).renameTo(path);
+            return Data::File::Delta;
+        }
+        Poco::File(delta).remove();
+    }
+
+    // Full version starts new chain
+    BinaryDelta::signature(path, signature, _deltaBlock, 0, file->crc32);
+    return status;
 }
 
 bool BackupTask::processBatch()
@@ -255,10 +1569,13 @@ bool BackupTask::processBatch()
     return true;
 }
 
-void BackupTask::listFtpFiles(Listing_t& files, const std::string& path, bool stopOnFail)
+void BackupTask::listFtpFiles(Lister& files, const std::string& path, bool stopOnFail)
 {
-    if (testIgnore(Data::Ignore::AttributePath, path))
+    if (_ignores.prunePath(path))
         return; // skip directory by full path
+    if (path.empty() && !stopOnFail && App::get().config().getBool("list.recursive", false) &&
+            listRecursive(files))
+        return;
 
     try
         {
@@ -266,7 +1583,7 @@ void BackupTask::listFtpFiles(Listing_t& files, const std::string& path, bool st
         if (path.empty())
             writeLog("Checking features");
         else { // on enter change work dir
-            writeLog("List directory " + path);
+            traceFile("List directory", path);
             _ftp->setWorkingDirectory(App::lastToken(path, Poco::Path::separator()));
         }
 
@@ -282,11 +1599,12 @@ void BackupTask::listFtpFiles(Listing_t& files, const std::string& path, bool st
                 App::logger().warning("File has empty name, why!?");
                 continue;
             }
-            files.push_back(file);
-            if (file->isDirectory)
-                listFtpFiles(files, file->fullName);
-            else
-                writeLog("File found " + file->fullName);
+            files.push(file);
+            if (file->isDirectory) {
+                if (_scan.enter(file->fullName))
+                    listFtpFiles(files, file->fullName);
+            } else
+                traceFile("File found", file->fullName);
         }
 
         if (!path.empty()) // on exit restore previous
@@ -303,37 +1621,125 @@ void BackupTask::listFtpFiles(Listing_t& files, const std::string& path, bool st
     }
 }
 
+bool BackupTask::listRecursive(Lister& files)
+{
+    writeLog("Checking recursive listing");
+    std::istream* istream = 0;
+    try { istream = &_ftp->beginList("-lR", true); }
+    catch (Poco::Net::FTPException& ex) {
+        writeLog("Recursive listing is refused, " + ex.message());
+        return false;
+    }
+
+    // Section of directory is taken only if it was listed in its parent and is not
+    // ignored or skipped. Dates are server local time, so entries wait till the end
+    // of listing when control connection is free to ask for the offset
+    const Poco::DateTime now;
+    std::set<std::string> pending; // listed directories without own section yet
+    std::string line, dir, name, size, modify;
+    bool isDirectory, accepted = true, blank = true; // root section may come without header
+    size_t parsed = 0;
+    Listing_t listing;
+    std::vector<std::string> sizes;
+    while (std::getline(*istream, line)) {
+        if (line.empty() || "\r" == line) {
+            blank = true;
+            continue;
+        }
+        // Header follows empty line, entry named "x:" is not taken for it
+        const bool entry = ListParser::parseLong(line, now.year(), now.month(), name, isDirectory, size, modify);
+        if (!entry && blank && ListParser::parseSection(line, dir))
+            accepted = dir.empty() || pending.erase(dir);
+        blank = false;
+        if (!entry) continue;
+        ++parsed;
+        if (!accepted) continue;
+
+        const std::string fullName = dir + Poco::Path::separator() + name;
+        if (_ignores.matchName(fullName))
+            continue;
+        Data::File::Ptr_t file = _site->createFile(fullName, modify, isDirectory);
+        Poco::NumberParser::tryParseUnsigned64(size, file->size);
+        listing.push_back(file);
+        sizes.push_back(size);
+        if (isDirectory && !_ignores.prunePath(fullName) && _scan.enter(fullName))
+            pending.insert(fullName);
+    }
+    _ftp->endList();
+    if (!parsed) {
+        writeLog("Recursive listing is not understood");
+        return false;
+    }
+    writeLog("Enabled recursive LIST mode");
+    detectListOffset(listing);
+
+    size_t i = 0;
+    for (Listing_t::const_iterator it = listing.begin(), end = listing.end(); it != end; ++it, ++i) {
+        Data::File::Ptr_t file = *it;
+        ListParser::toUtc(file->modifyDate, _listOffset);
+        if (file->isDirectory) {
+            files.push(file);
+            continue;
+        }
+        if (_ignores.matchFacts(sizes[i], file->modifyDate)) continue;
+        files.push(file);
+        traceFile("File found", file->fullName);
+    }
+
+    // Server did not recurse into these, they are walked as usual
+    for (std::set<std::string>::const_iterator it = pending.begin(), end = pending.end(); it != end; ++it) {
+        if (isBuried(pending, *it)) continue; // listed with parent
+        const Poco::Path parent(*it);
+        for (int i = 0, count = parent.depth(); i < count; ++i)
+            _ftp->setWorkingDirectory(parent[i]);
+        listFtpFiles(files, *it);
+        _ftp->rewind();
+    }
+    return true;
+}
+
+void BackupTask::detectListOffset(const Listing_t& listing)
+{
+    // Offset of server time zone from the first file listed with time, which MDTM gives in UTC
+    _listOffset = 60 * App::get().config().getInt(
+        Poco::format("list.utcOffset.%u", _site->id), App::get().config().getInt("list.utcOffset", 0));
+    for (Listing_t::const_iterator it = listing.begin(), end = listing.end(); it != end; ++it) {
+        const Data::File& file = **it;
+        if (file.isDirectory || 12 != file.modifyDate.size()) continue;
+        std::string utc;
+        int offset;
+        if (_ftp->modifyTime(file.fullName.substr(1), utc) && // relative to login directory ListParser::utcOffset(file.modifyDate, utc, offset)) {
+            _listOffset = offset;
+            writeLog("Listing time is UTC%+d minutes", _listOffset / 60);
+        }
+        return;
+    }
+}
+
 BackupTask::Listing_t BackupTask::makeBufferMLSD(const std::string& path)
 {
     if (path.empty()) writeLog("Enabled MLSD mode");
     Listing_t ret;
 
-    std::string line;
+    std::string line, fname;
+    ListParser::Facts_t keyValue;
     std::istream& istream = _ftp->beginMLSD();
     while (std::getline(istream, line)) {
-        Poco::StringTokenizer tok(line, ";", Poco::StringTokenizer::TOK_TRIM);
-        if (!tok.count()) continue;
-        // File name allways last token
-        const std::string& fname = tok[tok.count() - 1];
-        if ("." == fname || ".." == fname) continue;
-        if (testIgnore(Data::Ignore::AttributeExt, App::lastToken(fname, '.')))
-            continue;
+        if (!ListParser::parseMLSD(line, fname, keyValue)) continue;
+        const std::string fullName = path + Poco::Path::separator() + fname;
+        if (_ignores.matchName(fullName))
+            continue; // skipped directory is not listed
 
-        // Construct file attributes map from first tok.count() - 1 tokens
-        std::map<std::string, std::string> keyValue;
-        for (size_t i = 0, count = tok.count() - 1; i < count; ++i) {
-            const std::string& kv = tok[i];
-            const size_t pos = kv.find_first_of('=', 0);
-            if (std::string::npos == pos) continue;
-            keyValue[kv.substr(0, pos)] = kv.substr(pos + 1, kv.size() - pos);
-        }
         const std::string& type = keyValue["type"];
         if ("pdir" == type || "cdir" == type)
             continue; // allready skipped above
+        if ("dir" != type && _ignores.matchFacts(keyValue["size"], keyValue["modify"]))
+            continue;
 
-        ret.push_back(_site->createFile(
-            path + Poco::Path::separator() + fname,
-            keyValue["modify"], "dir" == type));
+        Data::File::Ptr_t file = _site->createFile(fullName, keyValue["modify"], "dir" == type);
+        Poco::NumberParser::tryParseUnsigned64(keyValue["size"], file->size);
+        file->unique = keyValue["unique"];
+        ret.push_back(file);
     }
     _ftp->endMLSD();
     return ret;
@@ -347,17 +1753,14 @@ BackupTask::Listing_t BackupTask::makeBufferDefault(const std::string& path)
     std::string line;
     std::istream& istream = _ftp->beginList();
     while (std::getline(istream, line)) {
-        line = App::lastToken(line, Poco::Path::separator());
-        if (line.empty() || "." == line || ".." == line)
-            continue;
-        if ('\r' == *line.rbegin() || '\n' == *line.rbegin())
-            line.resize(line.size() - 1); // trim end
-        if (testIgnore(Data::Ignore::AttributeExt, App::lastToken(line, '.')))
-            continue; // skip file by extension
+        line = ListParser::parseName(line);
+        if (line.empty()) continue;
+        const std::string fullName = path + Poco::Path::separator() + line;
+        if (_ignores.matchName(fullName))
+            continue; // skip file by name rules, size and age are not known here
 
         // Create empty entries
-        ret.push_back(_site->createFile(
-            path + Poco::Path::separator() + line, _timePoint, false));
+        ret.push_back(_site->createFile(fullName, _timePoint, false));
     }
     _ftp->endList();
 
@@ -380,30 +1783,54 @@ BackupTask::Listing_t BackupTask::makeBufferDefault(const std::string& path)
     return ret;
 }
 
-bool BackupTask::testIgnore(Data::Ignore::Attribute attr, const std::string& value)
+void BackupTask::writeLog(const std::string& msg)
 {
-    if (attr < 0 || (size_t)attr >= _ignoreOperands.size()) return false;
-    const std::set<std::string>& operands = _ignoreOperands[attr];
-    return operands.find(value) != operands.end();
+    Poco::Logger& logger = App::logger();
+    if (logger.information())
+        logger.information(Poco::format("Site(%u) " + msg, _site->id));
 }
 
-void BackupTask::writeLog(const std::string& msg)
+void BackupTask::writeLog(const std::string& msg, const Poco::Any& arg)
 {
-    App::logger().information(Poco::format("Site(%u) " + msg, _site->id));
+    Poco::Logger& logger = App::logger();
+    if (logger.information())
+        logger.information(Poco::format("Site(%u) " + msg, _site->id, arg));
 }
 
-void BackupTask::writeLog(const std::string& msg, const Poco::Any& arg)
+void BackupTask::traceFile(const char* what, const std::string& fullName)
 {
-    App::logger().information(Poco::format("Site(%u) " + msg, _site->id, arg));
+    Poco::Logger& logger = App::logger();
+    if (logger.debug())
+        logger.debug(Poco::format("Site(%u) %s %s", _site->id, std::string(what), fullName));
 }
 
 void BackupTask::reconnect()
 {
+    delete _ftp;
+    _ftp = 0;
     _ftp = FtpClient::createConnect();
     _ftp->login(_site->login, _site->password);
+    if (compressTransfers() && _ftp->enableCompression())
+        writeLog("Enabled MODE Z");
+}
+
+bool BackupTask::compressTransfers()
+{
+    return App::get().config().getBool("ftp.compress", true);
 }
 
 std::string BackupTask::backupDir()
 {
     return App::config("backup.path", "/var/tmp/" + App::get().commandName());
 }
+
+RestoreTask::RestoreTask(Data::Site::Ptr_t site, const Poco::DateTime& dt, const StrList_t& filter) :
+    Task(Poco::format("RestoreTask %u", site->id)), _site(site), _dt(dt), _filter(filter)
+{
+}
+
+void RestoreTask::runTask()
+{
+    BackupTask::restore(_site, _dt, _filter, this);
+    setProgress(1);
+}
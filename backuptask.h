@@ -2,10 +2,19 @@
 #define BACKUPTASK_H
 
 #include "data.h"
+#include "ignorematcher.h"
+#include "journal.h"
+#include "scanscheduler.h"
 #include <list>
 #include <set>
+#include <map>
 #include <Poco/Any.h>
 #include <Poco/Task.h>
+#include <Poco/Mutex.h>
+
+class Codec;
+class Manifest;
+class RestoreTask;
 
 typedef std::vector<std::string> StrList_t;
 typedef Poco::SharedPtr<StrList_t> StrListPtr_t;
@@ -13,39 +22,184 @@ typedef Poco::SharedPtr<StrList_t> StrListPtr_t;
 class BackupTask : public Poco::Task
 {
 public:
-    BackupTask(Data::Site::Ptr_t site, StrListPtr_t batch);
+    // Estimate run only lists site and compares it with stored state
+    BackupTask(Data::Site::Ptr_t site, StrListPtr_t batch, bool estimate = false);
     ~BackupTask();
 
+    Data::Site::Ptr_t site() const { return _site; }
+
+    struct Estimate
+    {
+        size_t added, modified, deleted;
+        Poco::UInt64 bytes; // to download, by sizes from listing
+    };
+    const Estimate& estimate() const { return _estimate; }
+    // Run completed without error and was not cancelled
+    bool succeeded() const { return _succeeded; }
+    static std::string formatBytes(Poco::UInt64 bytes);
+
     void runTask();
 
-    static void restore(Data::Site::Ptr_t site, Poco::DateTime dt);
+    // Only entries under filter paths or globs are restored, all if it is empty.
+    // Task, if given, receives progress of extraction
+    static void restore(Data::Site::Ptr_t site, Poco::DateTime dt, const StrList_t& filter = StrList_t(),
+                        RestoreTask* task = 0);
+    // Merge archives into synthetic full snapshot and remove superseded ones
+    static void compact(Data::Site::Ptr_t site);
+    // Read archives not verified recently and check member checksums,
+    // files with damaged current version are downloaded again by next run
+    static void verify(Data::Site::Ptr_t site);
+
+    // Keep ftp sessions opened between runs (service mode)
+    static void keepConnections(bool keep);
+
+    // Root of archives, backup.path
+    static std::string backupDir();
+    // storage.mode = mirror keeps directory per timepoint instead of archive
+    static bool mirrorMode();
 
 private:
     bool processBatch();
 
+    // Archive what interrupted runs committed, keep their other downloads for reuse
+    void recoverInterrupted();
+    // Download file or take the same version left by interrupted run, return crc32
+    unsigned fetch(const Data::File& file, const std::string& path);
+    std::string resumeDir() const;
+    // Queue upload of archive given without codec extension
+    static void replicate(const std::string& archive);
+
     typedef std::list<Data::File::Ptr_t> Listing_t;
-    void listFtpFiles(Listing_t& files, const std::string& path = "",
+
+    // State of manifest entry after listing
+    enum EntryState { EntryDeleted, EntryUnchanged, EntryChanged };
+    void loadManifest(Manifest& manifest);
+    void estimateChanges(const Listing_t& ftpFiles, const Manifest& manifest);
+    void saveManifest(const Manifest& manifest, const std::vector<char>& states,
+                      const Data::File::List_t& changed, const std::map<size_t, std::string>& uniques,
+                      const std::map<size_t, std::string>& dates);
+    // Manifest files by unique fact and by modify date, moved file keeps both
+    struct MoveIndex
+    {
+        std::map<std::string, size_t> byUnique;
+        std::multimap<std::string, size_t> byDate;
+    };
+    static void indexMoves(const Manifest& manifest, MoveIndex& index);
+    // New file matches entry which is not listed yet, so it waits for the end of listing
+    static bool mayBeMoved(const MoveIndex& index, const std::vector<char>& states, const Data::File& file);
+    // Put stored content of disappeared files which reappear as added ones to
+    // resume directory under new names, matched by unique fact or server crc32
+    void reuseMoved(const Manifest& manifest, const std::vector<char>& states, const MoveIndex& index,
+                    const Listing_t& added);
+    // Entry is under one of deleted directories
+    static bool isBuried(const std::set<std::string>& tombstones, const std::string& fullName);
+
+    class Lister;
+    void listFtpFiles(Lister& files, const std::string& path = "",
                       bool stopOnFail = false);
+    // Whole site by one LIST -lR, directories missing in its output are walked.
+    // False if server refused it, nothing is listed then
+    bool listRecursive(Lister& files);
+    // Time zone of LIST dates, configured one unless MDTM tells it
+    void detectListOffset(const Listing_t& listing);
     Listing_t makeBufferMLSD(const std::string& path);
     Listing_t makeBufferDefault(const std::string& path);
 
-    bool testIgnore(Data::Ignore::Attribute attr, const std::string& value);
+    // Choose full or delta storage for downloaded file and prepare signature of it
+    Data::File::Status storeVersion(Data::File::Ptr_t file, Data::File::Status status,
+                                    unsigned baseCrc32, const std::string& path, std::string& signature);
+    // Build site state at timePoint in dir, return timepoint of the latest change or 0 if nothing found
+    static Data::TimePoint_t materialize(Data::Site::Ptr_t site, Data::TimePoint_t timePoint, const std::string& dir,
+                                         RestoreTask* task = 0, const PathFilter* filter = 0);
+    static void collectGarbage(Data::Site::Ptr_t site, const std::vector<Data::TimePoint_t>& snapshots,
+                               Data::TimePoint_t cutoff);
+
+    typedef std::map<std::string, Data::File::Status> Changes_t; // by fullName
+    // Make mirror of tp from state at base (0 if unknown) and changed files moved out of workdir
+    void buildMirror(const std::string& workdir, Data::TimePoint_t tp, const Changes_t& changes,
+                     Data::TimePoint_t base);
+    // Complete mirror snapshots of the site in ascending order
+    static std::vector<Data::TimePoint_t> mirrors(unsigned siteId);
+    // Mirror snapshots not needed to restore after cutoff are removed
+    static void pruneMirrors(Data::Site::Ptr_t site, Data::TimePoint_t cutoff);
+    // Hard link copy of tree, dst is created
+    static void linkTree(const std::string& src, const std::string& dst);
+    // Extract files from archive path given without codec extension
+    static void extract(const std::string& archive, const Listing_t& files, const std::string& dir);
+    struct ExtractJob
+    {
+        std::string archive, dir;
+        const Listing_t* files;
+    };
+    typedef std::vector<ExtractJob> ExtractJobs_t;
+    // Extract archives on restore.threads threads, archives hold different files
+    static void extractAll(const ExtractJobs_t& jobs, RestoreTask* task);
+    static void reportProgress(RestoreTask* task, float progress);
+    // Configured codec or none if content of dir is mostly incompressible
+    static const Codec& chooseCodec(const std::string& dir);
+    // tar of dir (or of members listed in fileList) is written to <archive>.part<ext> and
+    // renamed to <archive><ext> only when tar succeeded, so final name is always complete
+    static void createArchive(const std::string& dir, const std::string& archive, const Codec& codec,
+                              const std::string& fileList = "");
 
     void writeLog(const std::string& msg);
     void writeLog(const std::string& msg, const Poco::Any& arg);
+    // Per file message, formatted only if debug level is enabled
+    void traceFile(const char* what, const std::string& fullName);
 
+    // Reuse idle session of the site or open new one
+    void connect();
     void reconnect();
-    
-    static std::string backupDir();
+    // ftp.compress, MODE Z is used for listings and downloads if server has it
+    static bool compressTransfers();
+
+    static std::string manifestPath(unsigned siteId);
+    static std::string archivePath(unsigned siteId, Data::TimePoint_t tp);
+    static std::string snapshotPath(unsigned siteId, Data::TimePoint_t tp);
+    static std::string mirrorPath(unsigned siteId, Data::TimePoint_t tp);
 
 private:
     class FtpClient;
+    class Extractor;
+    class Verifier;
+    class Archiver;
     FtpClient *_ftp;
+    FtpClient *_transfer; // downloads while _ftp lists, pipeline only
+
+    static bool _keepConnections;
+    static Poco::FastMutex _connectionsMutex;
+    static std::map<unsigned, FtpClient*> _connections; // idle sessions by site id
 
     Data::Site::Ptr_t _site;
-    std::vector<std::set<std::string> > _ignoreOperands;
+    IgnoreMatcher _ignores;
+    ScanScheduler _scan;
+    Journal::Record::Map_t _resume; // downloads of interrupted runs by name
     StrListPtr_t _batch;
     std::string _timePoint;
+    bool _estimateOnly;
+    bool _succeeded;
+    Estimate _estimate;
+
+    bool _deltaEnabled;
+    unsigned _deltaBlock, _deltaChain;
+    Poco::UInt64 _deltaMinSize;
+    int _listOffset; // seconds LIST local time is ahead of UTC
+};
+
+// Restore run under TaskManager to report its progress
+class RestoreTask : public Poco::Task
+{
+public:
+    RestoreTask(Data::Site::Ptr_t site, const Poco::DateTime& dt, const StrList_t& filter = StrList_t());
+
+    void runTask();
+
+private:
+    friend class BackupTask;
+
+    Data::Site::Ptr_t _site;
+    Poco::DateTime _dt;
+    StrList_t _filter;
 };
 
 #endif // BACKUPTASK_H
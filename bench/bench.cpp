@@ -0,0 +1,193 @@
+#include "fakeftpserver.h"
+#include "data.h"
+#include "backuptask.h"
+#include "main.h"
+
+#include <iostream>
+#include <sys/resource.h>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/Random.h>
+#include <Poco/Timezone.h>
+#include <Poco/Stopwatch.h>
+#include <Poco/FileStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/TaskManager.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/Data/Session.h>
+#include <Poco/Data/SessionFactory.h>
+#include <Poco/Data/MySQL/Connector.h>
+#include <Poco/Util/Application.h>
+
+using Poco::Util::Application;
+using Poco::Data::use;
+using Poco::Data::now;
+using Poco::Data::MySQL::Connector;
+
+const std::string App::EmptyString;
+
+class Bench : public Application
+{
+    struct TreeStats
+    {
+        size_t dirs, files;
+        Poco::UInt64 bytes;
+
+        TreeStats() : dirs(0), files(0), bytes(0) { }
+    };
+
+protected:
+    void initialize(Application& self)
+    {
+        loadConfiguration();
+        Application::initialize(self);
+    }
+
+    int main(const std::vector<std::string>& args)
+    {
+        (void)args;
+        const std::string path = config().getString("bench.path", "/tmp/ftpbackup-bench");
+        Poco::File workdir(path);
+        if (workdir.exists()) workdir.remove(true);
+
+        FakeFtpServer::Options options;
+        options.root = path + "/tree";
+        options.dialect = config().getString("bench.ftp.dialect", "mlsd");
+        options.latency = config().getInt("bench.ftp.latency", 0);
+        options.bandwidth = config().getInt("bench.ftp.bandwidth", 0);
+        options.faultRate = config().getDouble("bench.ftp.faultRate", 0);
+        options.seed = config().getInt("bench.seed", 1);
+
+        // Generate synthetic tree
+        TreeStats tree;
+        Poco::Random random;
+        random.seed(options.seed);
+        Poco::File(options.root).createDirectories();
+        generateTree(options.root, config().getInt("bench.tree.depth", 3), random, tree);
+        std::cout << Poco::format("tree: %z directories, %z files, %s",
+            tree.dirs, tree.files, formatBytes(tree.bytes)) << std::endl;
+
+        FakeFtpServer server(options);
+        server.start();
+        config().setString("ftp.connection", Poco::format("127.0.0.1:%d", int(server.port())));
+        config().setString("backup.path", path + "/archive");
+        config().setString("restore.path", "/restore");
+
+        const unsigned siteId = config().getInt("bench.site", 1);
+        prepareDatabase(siteId);
+
+        Data data;
+        Data::Site::Ptr_t site = data.siteById(siteId);
+        if (!site) throw Poco::NotFoundException(Poco::format("Unable to find site with id %u", siteId));
+
+        Poco::Stopwatch sw;
+        sw.start();
+        {
+            Poco::TaskManager tm;
+            tm.start(new BackupTask(site, StrListPtr_t()));
+            tm.joinAll();
+        }
+        sw.stop();
+        report("backup", sw, tree.bytes);
+        std::cout << "archive: " << formatBytes(directorySize(Poco::File(path + "/archive"))) << std::endl;
+
+        // Restore up to current local time
+        Poco::DateTime dt;
+        dt.makeLocal(Poco::Timezone::tzd());
+        sw.restart();
+        BackupTask::restore(site, dt);
+        sw.stop();
+        report("restore", sw, tree.bytes);
+
+        server.stop();
+        return EXIT_OK;
+    }
+
+private:
+    void generateTree(const std::string& path, int depth, Poco::Random& random, TreeStats& stats)
+    {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 \n";
+        const int files = config().getInt("bench.tree.files", 20);
+        const int size = config().getInt("bench.tree.fileSize", 64 * 1024);
+        const double incompressible = config().getDouble("bench.tree.incompressible", 0.2);
+
+        std::vector<char> buffer;
+        for (int i = 0; i < files; ++i) {
+            // Random size in range [size / 2, size * 3 / 2)
+            buffer.resize(size / 2 + (size ? random.next(size) : 0));
+            const bool binary = random.nextDouble() < incompressible;
+            for (size_t j = 0, count = buffer.size(); j < count; ++j)
+                buffer[j] = binary ? char(random.nextChar())
+                                   : alphabet[random.next(sizeof(alphabet) - 1)];
+
+            Poco::FileOutputStream fos(Poco::format("%s/file%d.%s", path, i, std::string(binary ? "bin" : "txt")),
+                std::ios::out | std::ios::trunc | std::ios::binary);
+            fos.write(buffer.empty() ? 0 : &buffer[0], buffer.size());
+            ++stats.files;
+            stats.bytes += buffer.size();
+        }
+
+        if (depth <= 0) return;
+        for (int i = 0, fanout = config().getInt("bench.tree.fanout", 4); i < fanout; ++i) {
+            Poco::File dir(Poco::format("%s/dir%d", path, i));
+            dir.createDirectory();
+            ++stats.dirs;
+            generateTree(dir.path(), depth - 1, random, stats);
+        }
+    }
+
+    void prepareDatabase(unsigned siteId)
+    {
+        Connector::registerConnector();
+        {
+            Poco::Data::Session ses(Poco::Data::SessionFactory::instance().create(
+                Connector::KEY, App::config("mysql.connection")));
+
+            std::string schema;
+            Poco::FileInputStream fis(config().getString("bench.schema", "../schema.sql"));
+            Poco::StreamCopier::copyToString(fis, schema);
+            Poco::StringTokenizer tok(schema, ";",
+                Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+            for (size_t i = 0, count = tok.count(); i < count; ++i)
+                ses << tok[i], now;
+
+            // Start from empty site history
+            int id = siteId;
+            ses << "DELETE h FROM ftp_backup_history h JOIN ftp_backup_files f"
+                " ON h.fileId = f.id WHERE f.siteId = ?", use(id), now;
+            ses << "DELETE FROM ftp_backup_files WHERE siteId = ?", use(id), now;
+            ses << "DELETE FROM ftp_backup_ignores WHERE siteId = ?", use(id), now;
+            ses << "DELETE FROM ftp_mapping WHERE id = ?", use(id), now;
+            ses << "INSERT INTO ftp_mapping (id, clientLogin, clientPasswd)"
+                " VALUES (?, 'bench', 'bench')", use(id), now;
+        }
+        Connector::unregisterConnector();
+    }
+
+    static Poco::UInt64 directorySize(const Poco::File& dir)
+    {
+        Poco::UInt64 ret = 0;
+        if (!dir.exists()) return ret;
+        for (Poco::DirectoryIterator dit(dir); dit != Poco::DirectoryIterator(); ++dit)
+            ret += dit->isDirectory() ? directorySize(*dit) : dit->getSize();
+        return ret;
+    }
+
+    static std::string formatBytes(Poco::UInt64 bytes)
+    {
+        return Poco::format("%.2f MB", double(bytes) / (1024 * 1024));
+    }
+
+    static void report(const std::string& phase, const Poco::Stopwatch& sw, Poco::UInt64 bytes)
+    {
+        const double seconds = double(sw.elapsed()) / Poco::Timestamp::resolution();
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        std::cout << Poco::format("%s: %.3f s, %.2f MB/s, peak rss %ld KB", phase, seconds,
+            seconds > 0 ? double(bytes) / (1024 * 1024) / seconds : 0.0, long(usage.ru_maxrss)) << std::endl;
+    }
+};
+
+POCO_APP_MAIN(Bench)
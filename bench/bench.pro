@@ -0,0 +1,38 @@
+# -------------------------------------------------
+# End-to-end benchmark running BackupTask against a fake ftp server
+# -------------------------------------------------
+QT -= core \
+    gui
+TEMPLATE = app
+TARGET = bench
+SOURCES += bench.cpp \
+    fakeftpserver.cpp \
+    ../data.cpp \
+    ../backuptask.cpp \
+    ../ftpclient.cpp \
+    ../singleton.cpp \
+    ../binarydelta.cpp \
+    ../codec.cpp \
+    ../archivereader.cpp \
+    ../ignorematcher.cpp \
+    ../listparser.cpp \
+    ../manifest.cpp \
+    ../journal.cpp \
+    ../replicator.cpp \
+    ../tracer.cpp \
+    ../scanscheduler.cpp
+INCLUDEPATH += .. \
+    /usr/include/mysql
+CONFIG(debug, debug|release):LIBS += -lPocoFoundationd \
+    -lPocoUtild \
+    -lPocoNetd \
+    -lPocoDatad \
+    -lPocoMySQLd
+else:LIBS += -lPocoFoundation \
+    -lPocoUtil \
+    -lPocoNet \
+    -lPocoData \
+    -lPocoMySQL
+LIBS += -lzstd
+HEADERS += fakeftpserver.h
+OTHER_FILES += bench.properties
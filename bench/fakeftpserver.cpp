@@ -0,0 +1,330 @@
+#include "fakeftpserver.h"
+
+#include <sstream>
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/Random.h>
+#include <Poco/String.h>
+#include <Poco/Thread.h>
+#include <Poco/FileStream.h>
+#include <Poco/NumberFormatter.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/Net/SocketStream.h>
+#include <Poco/Net/TCPServerConnection.h>
+#include <Poco/Net/TCPServerConnectionFactory.h>
+
+using Poco::Net::StreamSocket;
+using Poco::Net::ServerSocket;
+using Poco::Net::SocketAddress;
+
+class FakeFtpServer::Connection : public Poco::Net::TCPServerConnection
+{
+    enum ListMode { ListMLSD, ListNames, ListLong };
+
+public:
+    Connection(const StreamSocket& socket, const Options& options) :
+        TCPServerConnection(socket), _options(options), _control(this->socket()), _cwd("/")
+    {
+        if (_options.seed) _random.seed(_options.seed);
+        else _random.seed();
+    }
+
+    void run()
+    {
+        reply(220, "ftpbackup bench server ready");
+
+        std::string line;
+        while (std::getline(_control, line)) {
+            if (!line.empty() && '\r' == *line.rbegin())
+                line.resize(line.size() - 1); // trim end
+
+            const size_t pos = line.find(' ');
+            const std::string cmd = Poco::toUpper(line.substr(0, pos));
+            const std::string arg = std::string::npos == pos ? std::string() : line.substr(pos + 1);
+            if ("QUIT" == cmd) {
+                reply(221, "Bye");
+                break;
+            }
+
+            try { dispatch(cmd, arg); }
+            catch (Poco::Exception& ex) {
+                _passive.reset();
+                reply(550, ex.message());
+            }
+        }
+    }
+
+private:
+    void dispatch(const std::string& cmd, const std::string& arg)
+    {
+        if ("USER" == cmd)
+            reply(331, "Password required");
+        else if ("PASS" == cmd)
+            reply(230, "Logged in");
+        else if ("TYPE" == cmd || "NOOP" == cmd)
+            reply(200, "OK");
+        else if ("SYST" == cmd)
+            reply(215, "UNIX Type: L8");
+        else if ("FEAT" == cmd) {
+            _control << "211-Features:\r\n";
+            if ("mlsd" == _options.dialect)
+                _control << " MLSD\r\n";
+            _control << " MDTM\r\n SIZE\r\n";
+            reply(211, "End");
+        }
+        else if ("PWD" == cmd)
+            reply(257, "\"" + _cwd + "\"");
+        else if ("CWD" == cmd) {
+            const std::string dir = resolve(arg);
+            Poco::File file(localPath(dir));
+            if (!file.exists() || !file.isDirectory())
+                reply(550, "No such directory");
+            else {
+                _cwd = dir;
+                reply(250, "OK");
+            }
+        }
+        else if ("CDUP" == cmd) {
+            _cwd = resolve("..");
+            reply(250, "OK");
+        }
+        else if ("EPSV" == cmd || "PASV" == cmd)
+            openPassive("EPSV" == cmd);
+        else if ("MLSD" == cmd && "mlsd" == _options.dialect)
+            sendListing(arg, ListMLSD);
+        else if ("NLST" == cmd)
+            sendListing(arg, ListNames);
+        else if ("LIST" == cmd)
+            sendListing(arg, ListLong);
+        else if ("RETR" == cmd)
+            retrieve(arg);
+        else if ("STOR" == cmd)
+            store(arg);
+        else if ("MDTM" == cmd)
+            reply(213, modifyDate(Poco::File(localPath(resolve(arg)))));
+        else if ("SIZE" == cmd)
+            reply(213, Poco::NumberFormatter::format(Poco::File(localPath(resolve(arg))).getSize()));
+        else if ("MKD" == cmd) {
+            const std::string dir = resolve(arg);
+            Poco::File file(localPath(dir));
+            if (file.exists())
+                reply(550, "Already exists");
+            else {
+                file.createDirectory();
+                reply(257, "\"" + dir + "\" created");
+            }
+        }
+        else if ("RMD" == cmd || "DELE" == cmd) {
+            Poco::File(localPath(resolve(arg))).remove(false);
+            reply(250, "Removed");
+        }
+        else
+            reply(502, "Command not implemented");
+    }
+
+    void reply(int code, const std::string& text)
+    {
+        if (_options.latency > 0)
+            Poco::Thread::sleep(_options.latency);
+        _control << code << ' ' << text << "\r\n" << std::flush;
+    }
+
+    // Map argument to normalized virtual path
+    std::string resolve(const std::string& arg) const
+    {
+        const std::string path = !arg.empty() && '/' == arg[0] ? arg : _cwd + "/" + arg;
+        Poco::StringTokenizer tok(path, "/", Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+
+        std::vector<std::string> parts;
+        for (size_t i = 0, count = tok.count(); i < count; ++i) {
+            if ("." == tok[i]) continue;
+            if (".." != tok[i]) parts.push_back(tok[i]);
+            else if (!parts.empty()) parts.pop_back();
+        }
+
+        std::string ret;
+        for (size_t i = 0, count = parts.size(); i < count; ++i)
+            ret += "/" + parts[i];
+        return ret.empty() ? "/" : ret;
+    }
+
+    std::string localPath(const std::string& vpath) const
+    {
+        return _options.root + vpath;
+    }
+
+    static std::string modifyDate(const Poco::File& file)
+    {
+        return Poco::DateTimeFormatter::format(file.getLastModified(), "%Y%m%d%H%M%S");
+    }
+
+    void openPassive(bool extended)
+    {
+        _passive.reset(new ServerSocket(SocketAddress(socket().address().host(), 0)));
+        const int port = _passive->address().port();
+        if (extended)
+            reply(229, Poco::format("Entering Extended Passive Mode (|||%d|)", port));
+        else
+            reply(227, Poco::format("Entering Passive Mode (%s,%d,%d)",
+                Poco::replace(socket().address().host().toString(), ".", ","), port / 256, port % 256));
+    }
+
+    StreamSocket acceptData()
+    {
+        if (!_passive.get())
+            throw Poco::IllegalStateException("Use PASV or EPSV first");
+        StreamSocket ret = _passive->acceptConnection();
+        _passive.reset();
+        return ret;
+    }
+
+    void sendListing(const std::string& arg, ListMode mode)
+    {
+        Poco::File dir(localPath(resolve(arg)));
+        if (!dir.exists() || !dir.isDirectory()) {
+            _passive.reset();
+            reply(550, "No such directory");
+            return;
+        }
+
+        std::vector<std::string> names;
+        dir.list(names);
+        std::sort(names.begin(), names.end());
+
+        std::ostringstream out;
+        if (ListMLSD == mode)
+            out << "type=cdir;modify=" << modifyDate(dir) << "; .\r\n";
+        for (size_t i = 0, count = names.size(); i < count; ++i) {
+            Poco::File file(dir.path() + "/" + names[i]);
+            const bool isDir = file.isDirectory();
+            switch (mode) {
+                case ListMLSD:
+                    out << "type=" << (isDir ? "dir" : "file") << ";size=" << (isDir ? 0 : file.getSize())
+                        << ";modify=" << modifyDate(file) << "; " << names[i] << "\r\n";
+                    break;
+                case ListLong:
+                    out << (isDir ? "drwxr-xr-x" : "-rw-r--r--") << " 1 ftp ftp " << (isDir ? 0 : file.getSize())
+                        << ' ' << Poco::DateTimeFormatter::format(file.getLastModified(), "%b %d %H:%M")
+                        << ' ' << names[i] << "\r\n";
+                    break;
+                default:
+                    out << names[i] << "\r\n";
+            }
+        }
+
+        StreamSocket data = acceptData();
+        reply(150, "Opening data connection");
+        std::istringstream in(out.str());
+        send(data, in);
+        data.close();
+        reply(226, "Transfer complete");
+    }
+
+    void retrieve(const std::string& arg)
+    {
+        Poco::File file(localPath(resolve(arg)));
+        if (!file.exists() || file.isDirectory()) {
+            _passive.reset();
+            reply(550, "No such file");
+            return;
+        }
+        if (_options.faultRate > 0 && _random.nextDouble() < _options.faultRate) {
+            _passive.reset();
+            reply(451, "Injected fault");
+            return;
+        }
+
+        StreamSocket data = acceptData();
+        reply(150, "Opening data connection");
+        Poco::FileInputStream in(file.path());
+        send(data, in);
+        data.close();
+        reply(226, "Transfer complete");
+    }
+
+    void store(const std::string& arg)
+    {
+        const std::string path = localPath(resolve(arg));
+        StreamSocket data = acceptData();
+        reply(150, "Opening data connection");
+
+        Poco::FileOutputStream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        char buffer[16384];
+        for (int n = data.receiveBytes(buffer, sizeof(buffer)); n > 0;
+             n = data.receiveBytes(buffer, sizeof(buffer)))
+            out.write(buffer, n);
+        out.close();
+        data.close();
+        reply(226, "Transfer complete");
+    }
+
+    // Write stream content to data connection honoring bandwidth limit
+    void send(StreamSocket& data, std::istream& in)
+    {
+        char buffer[16384];
+        Poco::Timestamp started;
+        Poco::UInt64 sent = 0;
+        while (in.read(buffer, sizeof(buffer)) || in.gcount()) {
+            const int size = static_cast<int>(in.gcount());
+            for (int pos = 0; pos < size; )
+                pos += data.sendBytes(buffer + pos, size - pos);
+            sent += size;
+
+            if (_options.bandwidth > 0) {
+                const Poco::Timestamp::TimeDiff expected = sent * 1000000 / _options.bandwidth;
+                const Poco::Timestamp::TimeDiff elapsed = started.elapsed();
+                if (expected > elapsed)
+                    Poco::Thread::sleep(long((expected - elapsed) / 1000));
+            }
+        }
+    }
+
+private:
+    const Options& _options;
+    Poco::Net::SocketStream _control;
+    std::auto_ptr<ServerSocket> _passive;
+    std::string _cwd;
+    Poco::Random _random;
+};
+
+//-----------------------------------------------------------------------------
+class FakeFtpServer::ConnectionFactory : public Poco::Net::TCPServerConnectionFactory
+{
+public:
+    explicit ConnectionFactory(const Options& options) : _options(options) { }
+
+    Poco::Net::TCPServerConnection* createConnection(const StreamSocket& socket)
+    {
+        return new Connection(socket, _options);
+    }
+
+private:
+    const Options& _options;
+};
+
+//=============================================================================
+FakeFtpServer::FakeFtpServer(const Options& options) : _options(options),
+    _socket(SocketAddress("127.0.0.1", 0))
+{
+}
+
+FakeFtpServer::~FakeFtpServer()
+{
+    stop();
+}
+
+void FakeFtpServer::start()
+{
+    if (_server.get()) return;
+    _server.reset(new Poco::Net::TCPServer(new ConnectionFactory(_options), _socket));
+    _server->start();
+}
+
+void FakeFtpServer::stop()
+{
+    if (!_server.get()) return;
+    _server->stop();
+    _server.reset();
+}
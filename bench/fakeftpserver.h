@@ -0,0 +1,42 @@
+#ifndef FAKEFTPSERVER_H
+#define FAKEFTPSERVER_H
+
+#include <memory>
+#include <Poco/Net/TCPServer.h>
+#include <Poco/Net/ServerSocket.h>
+
+// Minimal in-process ftp server serving a local directory.
+// It understands only the commands issued by BackupTask::FtpClient
+class FakeFtpServer
+{
+public:
+    struct Options
+    {
+        std::string root;   // served directory
+        std::string dialect; // "mlsd" or "list"
+        int latency;        // delay before each control reply in milliseconds
+        int bandwidth;      // data connection limit in bytes per second, 0 is unlimited
+        double faultRate;   // probability to fail RETR command
+        unsigned seed;
+
+        Options() : dialect("mlsd"), latency(0), bandwidth(0), faultRate(0), seed(0) { }
+    };
+
+    explicit FakeFtpServer(const Options& options);
+    ~FakeFtpServer();
+
+    Poco::UInt16 port() const { return _socket.address().port(); }
+
+    void start();
+    void stop();
+
+private:
+    class Connection;
+    class ConnectionFactory;
+
+    Options _options;
+    Poco::Net::ServerSocket _socket;
+    std::auto_ptr<Poco::Net::TCPServer> _server;
+};
+
+#endif // FAKEFTPSERVER_H
@@ -0,0 +1,303 @@
+#include "data.h"
+#include "ignorematcher.h"
+#include "listparser.h"
+#include "manifest.h"
+#include "main.h"
+
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/Random.h>
+#include <Poco/Checksum.h>
+#include <Poco/Stopwatch.h>
+#include <Poco/FileStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/Data/Session.h>
+#include <Poco/Data/SessionFactory.h>
+#include <Poco/Data/MySQL/Connector.h>
+#include <Poco/Util/Application.h>
+#include <Poco/Util/PropertyFileConfiguration.h>
+
+using Poco::Util::Application;
+using Poco::Data::use;
+using Poco::Data::now;
+using Poco::Data::MySQL::Connector;
+
+const std::string App::EmptyString;
+
+// Hot kernels measured alone. Every benchmark reports nanoseconds per item and
+// fails when it is slower than its baseline times micro.threshold. Baselines
+// are per host, missing ones are recorded to micro.baseline file.
+class MicroBench : public Application
+{
+    typedef void (MicroBench::*Kernel)();
+
+    struct Result
+    {
+        std::string name;
+        double nsPerItem;
+    };
+
+public:
+    MicroBench() : _items(0), _sink(0) { }
+
+protected:
+    void initialize(Application& self)
+    {
+        loadConfiguration();
+        Application::initialize(self);
+    }
+
+    int main(const std::vector<std::string>& args)
+    {
+        (void)args;
+        _items = std::max(1, config().getInt("micro.items", 10000));
+        prepareInput();
+
+        measure("mlsd_parse", &MicroBench::mlsdParse);
+        measure("list_parse", &MicroBench::listParse);
+        measure("crc32_bytes", &MicroBench::crc32Bytes);
+        measure("crc32_buffer", &MicroBench::crc32Buffer);
+        measure("ignore_match", &MicroBench::ignoreMatch);
+        measure("last_token", &MicroBench::lastToken);
+        measure("manifest_diff", &MicroBench::manifestDiff);
+        if (config().getBool("micro.database", true)) {
+            prepareDatabase();
+            measure("site_files", &MicroBench::siteFiles);
+        }
+        return compare() ? EXIT_OK : EXIT_SOFTWARE;
+    }
+
+private:
+    // Best of micro.repeat runs, each one repeats kernel for at least micro.minTime ms
+    void measure(const std::string& name, Kernel kernel)
+    {
+        const Poco::Timestamp::TimeDiff minTime = config().getInt("micro.minTime", 200) * 1000;
+        double best = 0;
+        for (int run = 0, count = std::max(1, config().getInt("micro.repeat", 5)); run < count; ++run) {
+            Poco::Stopwatch sw;
+            size_t passes = 0;
+            sw.start();
+            do {
+                (this->*kernel)();
+                ++passes;
+            } while (sw.elapsed() < minTime);
+            sw.stop();
+
+            const double ns = double(sw.elapsed()) * 1000 / (double(passes) * _items);
+            if (!run || ns < best) best = ns;
+        }
+
+        Result result;
+        result.name = name;
+        result.nsPerItem = best;
+        _results.push_back(result);
+    }
+
+    // Print results against baselines, record missing ones, false on regression
+    bool compare()
+    {
+        const std::string path = config().getString("micro.baseline", "microbench.baseline");
+        Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> baseline(new Poco::Util::PropertyFileConfiguration);
+        if (Poco::File(path).exists()) baseline->load(path);
+        const bool record = config().getBool("micro.record", false);
+
+        bool passed = true, changed = false;
+        for (size_t i = 0, count = _results.size(); i < count; ++i) {
+            const Result& r = _results[i];
+            const double threshold = config().getDouble("micro.threshold." + r.name,
+                config().getDouble("micro.threshold", 1.3));
+            if (record || !baseline->hasProperty(r.name)) {
+                baseline->setDouble(r.name, r.nsPerItem);
+                changed = true;
+                std::cout << Poco::format("%s: %.1f ns, baseline recorded", r.name, r.nsPerItem) << std::endl;
+                continue;
+            }
+
+            const double base = baseline->getDouble(r.name);
+            const bool ok = r.nsPerItem <= base * threshold;
+            std::cout << Poco::format("%s: %.1f ns, baseline %.1f ns, limit %.1f ns %s", r.name, r.nsPerItem,
+                base, base * threshold, std::string(ok ? "ok" : "REGRESSION")) << std::endl;
+            passed = passed && ok;
+        }
+        if (changed) baseline->save(path);
+        return passed;
+    }
+
+    void prepareInput()
+    {
+        Poco::Random random;
+        random.seed(config().getInt("bench.seed", 1));
+
+        // Names as in a deep site tree, a quarter of them directories
+        static const char* exts[] = { "html", "php", "jpg", "css", "js", "log", "tmp", "txt" };
+        for (size_t i = 0; i < _items; ++i) {
+            std::string name = "/www";
+            for (int depth = 0, count = 1 + random.next(5); depth < count; ++depth)
+                name += Poco::format("/dir%u", random.next(32));
+            const bool dir = 0 == random.next(4);
+            _names.push_back(dir ? Poco::format("%s/sub%z", name, i)
+                                 : Poco::format("%s/file%z.%s", name, i, std::string(exts[random.next(8)])));
+            _isDirectory.push_back(dir);
+
+            const std::string modify = Poco::format("2024%02u%02u%02u%02u%02u", 1 + random.next(12),
+                1 + random.next(28), random.next(24), random.next(60), random.next(60));
+            _modifyDates.push_back(modify);
+            _mlsdLines.push_back(Poco::format("type=%s;size=%u;modify=%s;perm=adfrw;unique=%uU%z; %s\r",
+                std::string(dir ? "dir" : "file"), random.next(1 << 20), modify, random.next(), i,
+                App::lastToken(_names.back(), '/')));
+            _listLines.push_back(_names.back() + "\r");
+        }
+
+        _buffer.resize(_items);
+        for (size_t i = 0, count = _buffer.size(); i < count; ++i)
+            _buffer[i] = random.nextChar();
+
+        // Rule mix of a typical site: exact extension and path rules, globs, regex and limits
+        static const struct { Data::Ignore::Attribute attribute; const char* operand; } rules[] = {
+            { Data::Ignore::AttributeExt, "tmp" }, { Data::Ignore::AttributeExt, "log" },
+            { Data::Ignore::AttributePath, "/www/dir3" }, { Data::Ignore::AttributeGlob, "*/cache/*" },
+            { Data::Ignore::AttributeGlob, "*.bak" }, { Data::Ignore::AttributeRegex, ".*/session_[0-9a-f]+$" },
+            { Data::Ignore::AttributeSize, "100M" }, { Data::Ignore::AttributeAge, "365d" } };
+        Data::Ignore::List_t ignores;
+        for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); ++i) {
+            Data::Ignore::Ptr_t ignore(new Data::Ignore);
+            ignore->attribute = rules[i].attribute;
+            ignore->operand = rules[i].operand;
+            ignores.push_back(ignore);
+        }
+        _ignores.compile(ignores, Poco::Timestamp().epochMicroseconds());
+
+        // Manifest of the same names, half of the files have other modify date
+        Manifest::Record::List_t records(_items);
+        for (size_t i = 0; i < _items; ++i) {
+            records[i].id = unsigned(i + 1);
+            records[i].crc32 = 0;
+            records[i].isDirectory = _isDirectory[i];
+            records[i].fullName = _names[i];
+            records[i].modifyDate = i % 2 ? _modifyDates[i] : "20000101000000";
+        }
+        _generation.count = Poco::Int64(_items);
+        _generation.timePoint = 1;
+        _manifestPath = config().getString("bench.path", "/tmp/ftpbackup-bench") + "/micro.manifest";
+        Poco::File(Poco::Path(_manifestPath).parent()).createDirectories();
+        Manifest::write(_manifestPath, _generation, records);
+        if (!_manifest.open(_manifestPath, _generation))
+            throw Poco::IllegalStateException("Unable to open manifest " + _manifestPath);
+    }
+
+    // Trunk of site micro.site with micro.items files read back by Site::files()
+    void prepareDatabase()
+    {
+        Connector::registerConnector();
+        {
+            Poco::Data::Session ses(Poco::Data::SessionFactory::instance().create(
+                Connector::KEY, App::config("mysql.connection")));
+
+            std::string schema;
+            Poco::FileInputStream fis(config().getString("bench.schema", "../schema.sql"));
+            Poco::StreamCopier::copyToString(fis, schema);
+            Poco::StringTokenizer tok(schema, ";",
+                Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+            for (size_t i = 0, count = tok.count(); i < count; ++i)
+                ses << tok[i], now;
+
+            int id = config().getInt("micro.site", 2);
+            ses << "DELETE h FROM ftp_backup_history h JOIN ftp_backup_files f"
+                " ON h.fileId = f.id WHERE f.siteId = ?", use(id), now;
+            ses << "DELETE FROM ftp_backup_files WHERE siteId = ?", use(id), now;
+            ses << "DELETE FROM ftp_mapping WHERE id = ?", use(id), now;
+            ses << "INSERT INTO ftp_mapping (id, clientLogin, clientPasswd)"
+                " VALUES (?, 'micro', 'micro')", use(id), now;
+
+            std::vector<int> ids(_items, id), dirs(_isDirectory.begin(), _isDirectory.end());
+            ses << "INSERT INTO ftp_backup_files (siteId, crc32, timePoint, fullName, modifyDate, isDirectory)"
+                " VALUES (?, 0, 1, ?, ?, ?)", use(ids), use(_names), use(_modifyDates), use(dirs), now;
+            // Trunk is joined with the last history record of every file
+            ses << "INSERT INTO ftp_backup_history (fileId, timePoint, fileStatus)"
+                " SELECT id, timePoint, 0 FROM ftp_backup_files WHERE siteId = ?", use(id), now;
+        }
+        Connector::unregisterConnector();
+
+        _data.reset(new Data);
+        _site = _data->siteById(config().getInt("micro.site", 2));
+        if (!_site) throw Poco::NotFoundException("Unable to find micro.site");
+    }
+
+    void mlsdParse()
+    {
+        std::string name;
+        ListParser::Facts_t facts;
+        for (size_t i = 0; i < _items; ++i)
+            _sink += ListParser::parseMLSD(_mlsdLines[i], name, facts) ? name.size() + facts.size() : 0;
+    }
+
+    void listParse()
+    {
+        for (size_t i = 0; i < _items; ++i)
+            _sink += ListParser::parseName(_listLines[i]).size();
+    }
+
+    // As FtpClient::download() updates checksum, item is one byte
+    void crc32Bytes()
+    {
+        Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+        for (size_t i = 0; i < _items; ++i)
+            crc32.update(_buffer[i]);
+        _sink += crc32.checksum();
+    }
+
+    // Whole buffer at once, item is one byte too
+    void crc32Buffer()
+    {
+        Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+        crc32.update(&_buffer[0], static_cast<unsigned>(_items));
+        _sink += crc32.checksum();
+    }
+
+    void ignoreMatch()
+    {
+        for (size_t i = 0; i < _items; ++i)
+            _sink += _ignores.matchName(_names[i]) || _ignores.matchFacts("4096", _modifyDates[i]);
+    }
+
+    void lastToken()
+    {
+        for (size_t i = 0; i < _items; ++i)
+            _sink += App::lastToken(_names[i], '/').size();
+    }
+
+    // Lookup and modify date check runTask() makes for every listed entry
+    void manifestDiff()
+    {
+        for (size_t i = 0; i < _items; ++i) {
+            const size_t entry = _manifest.find(_names[i]);
+            if (Manifest::npos != entry && !_manifest.sameModifyDate(entry, _modifyDates[i])) ++_sink;
+        }
+    }
+
+    // Selected rows are turned into File objects, item is one file
+    void siteFiles()
+    {
+        _sink += _site->files().size();
+    }
+
+private:
+    size_t _items;
+    size_t _sink; // keeps results of kernels alive
+    std::vector<std::string> _names, _modifyDates, _mlsdLines, _listLines;
+    std::vector<bool> _isDirectory;
+    std::vector<char> _buffer;
+    IgnoreMatcher _ignores;
+    Data::Generation _generation;
+    std::string _manifestPath;
+    Manifest _manifest;
+    std::auto_ptr<Data> _data;
+    Data::Site::Ptr_t _site;
+    std::vector<Result> _results;
+};
+
+POCO_APP_MAIN(MicroBench)
@@ -0,0 +1,27 @@
+# -------------------------------------------------
+# Micro-benchmarks of hot kernels with per host baselines
+# -------------------------------------------------
+QT -= core \
+    gui
+TEMPLATE = app
+TARGET = microbench
+SOURCES += microbench.cpp \
+    ../data.cpp \
+    ../singleton.cpp \
+    ../tracer.cpp \
+    ../ignorematcher.cpp \
+    ../globautomaton.cpp \
+    ../listparser.cpp \
+    ../manifest.cpp
+INCLUDEPATH += .. \
+    /usr/include/mysql
+CONFIG(debug, debug|release):LIBS += -lPocoFoundationd \
+    -lPocoUtild \
+    -lPocoDatad \
+    -lPocoMySQLd
+else:LIBS += -lPocoFoundation \
+    -lPocoUtil \
+    -lPocoData \
+    -lPocoMySQL
+OTHER_FILES += microbench.properties \
+    microbench.baseline
@@ -0,0 +1,292 @@
+#include "binarydelta.h"
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/MD5Engine.h>
+#include <Poco/Checksum.h>
+#include <Poco/Exception.h>
+#include <Poco/FileStream.h>
+#include <Poco/BinaryReader.h>
+#include <Poco/BinaryWriter.h>
+
+using Poco::UInt8;
+using Poco::UInt32;
+using Poco::UInt64;
+using Poco::BinaryReader;
+using Poco::BinaryWriter;
+
+namespace
+{
+    const std::string SignatureMagic("FBS1");
+    const std::string DeltaMagic("FBD1");
+    const size_t StrongSize = 16;
+    const size_t BufferSize = 1 << 20;
+    const size_t MaxLiteral = 1 << 16;
+
+    enum Operation { OpCopy = 'C', OpLiteral = 'L', OpEnd = 'E' };
+
+    // Rolling checksum from rsync
+    struct RollSum
+    {
+        UInt32 a, b, count;
+
+        RollSum() : a(0), b(0), count(0) { }
+
+        void update(const char* data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i) {
+                a += static_cast<unsigned char>(data[i]);
+                b += a;
+            }
+            count += size;
+        }
+
+        void rotate(unsigned char out, unsigned char in)
+        {
+            a += in - out;
+            b += a - count * out;
+        }
+
+        UInt32 digest() const { return (b << 16) | (a & 0xffff); }
+    };
+
+    std::string strongSum(const char* data, size_t size)
+    {
+        Poco::MD5Engine md5;
+        md5.update(data, size);
+        const Poco::DigestEngine::Digest& digest = md5.digest();
+        return std::string(digest.begin(), digest.end());
+    }
+
+    void readMagic(BinaryReader& reader, const std::string& magic, const std::string& path)
+    {
+        std::string value;
+        reader.readRaw(static_cast<int>(magic.size()), value);
+        if (magic != value)
+            throw Poco::DataFormatException("Invalid binary delta file " + path);
+    }
+
+    // Merge sequential copies and write operations
+    class DeltaWriter
+    {
+    public:
+        explicit DeltaWriter(std::ostream& out) :
+            _writer(out, BinaryWriter::LITTLE_ENDIAN_BYTE_ORDER), _copyOffset(0), _copySize(0), _size(0)
+        {
+            _writer.writeRaw(DeltaMagic);
+        }
+
+        void copy(UInt64 offset, UInt64 size)
+        {
+            if (_copySize && _copyOffset + _copySize == offset) {
+                _copySize += size;
+                return;
+            }
+            flushCopy();
+            _copyOffset = offset;
+            _copySize = size;
+        }
+
+        void literal(const char* data, size_t size)
+        {
+            if (!size) return;
+            flushCopy();
+            _writer << UInt8(OpLiteral) << UInt32(size);
+            _writer.writeRaw(std::string(data, size));
+            _size += 5 + size;
+        }
+
+        UInt64 end(UInt32 crc32)
+        {
+            flushCopy();
+            _writer << UInt8(OpEnd) << crc32;
+            _writer.flush();
+            return _size + 5 + DeltaMagic.size();
+        }
+
+    private:
+        void flushCopy()
+        {
+            if (!_copySize) return;
+            _writer << UInt8(OpCopy) << _copyOffset << _copySize;
+            _size += 17;
+            _copySize = 0;
+        }
+
+        BinaryWriter _writer;
+        UInt64 _copyOffset, _copySize, _size;
+    };
+}
+
+void BinaryDelta::signature(const std::string& src, const std::string& dst,
+                            unsigned blockSize, unsigned chain, unsigned crc32)
+{
+    blockSize = std::min<unsigned>(std::max<unsigned>(blockSize, 64), BufferSize / 2);
+    Poco::FileInputStream in(src, std::ios::in | std::ios::binary);
+    Poco::FileOutputStream out(dst, std::ios::out | std::ios::trunc | std::ios::binary);
+    BinaryWriter writer(out, BinaryWriter::LITTLE_ENDIAN_BYTE_ORDER);
+    writer.writeRaw(SignatureMagic);
+    writer << UInt32(blockSize) << UInt32(chain) << UInt32(crc32);
+
+    // Only whole blocks are matched, tail is allways sent as literal
+    std::vector<char> block(blockSize);
+    while (in.read(&block[0], blockSize)) {
+        RollSum sum;
+        sum.update(&block[0], blockSize);
+        writer << sum.digest();
+        writer.writeRaw(strongSum(&block[0], blockSize));
+    }
+    writer.flush();
+}
+
+bool BinaryDelta::header(const std::string& sig, unsigned& chain, unsigned& crc32)
+{
+    if (!Poco::File(sig).exists()) return false;
+
+    Poco::FileInputStream in(sig, std::ios::in | std::ios::binary);
+    BinaryReader reader(in, BinaryReader::LITTLE_ENDIAN_BYTE_ORDER);
+    readMagic(reader, SignatureMagic, sig);
+    UInt32 blockSize, c, crc;
+    reader >> blockSize >> c >> crc;
+    if (!in.good()) return false;
+    chain = c;
+    crc32 = crc;
+    return true;
+}
+
+UInt64 BinaryDelta::encode(const std::string& sig, const std::string& src, const std::string& dst)
+{
+    // Load signature: index of weak sums and strong sums by block
+    Poco::FileInputStream sis(sig, std::ios::in | std::ios::binary);
+    BinaryReader sreader(sis, BinaryReader::LITTLE_ENDIAN_BYTE_ORDER);
+    readMagic(sreader, SignatureMagic, sig);
+    UInt32 blockSize, chain, crc;
+    sreader >> blockSize >> chain >> crc;
+    if (!sis.good() || !blockSize || blockSize > BufferSize / 2)
+        throw Poco::DataFormatException("Invalid signature header " + sig);
+
+    typedef std::vector<std::pair<UInt32, UInt32> > Index_t;
+    Index_t index;
+    std::vector<std::string> strong;
+    for (;;) {
+        UInt32 weak;
+        std::string sum;
+        sreader >> weak;
+        sreader.readRaw(static_cast<int>(StrongSize), sum);
+        if (StrongSize != sum.size()) break;
+        index.push_back(std::make_pair(weak, UInt32(strong.size())));
+        strong.push_back(sum);
+    }
+    std::sort(index.begin(), index.end());
+
+    Poco::FileInputStream in(src, std::ios::in | std::ios::binary);
+    Poco::FileOutputStream out(dst, std::ios::out | std::ios::trunc | std::ios::binary);
+    DeltaWriter delta(out);
+    Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+
+    // Window [pos, pos + blockSize) rolls over buffer, [lit, pos) is pending literal
+    std::vector<char> buf(BufferSize);
+    size_t len = 0, pos = 0, lit = 0;
+    bool eof = false;
+    RollSum sum;
+    for (;;) {
+        if (!eof && len - pos <= blockSize) {
+            // Flush pending literal and move window to buffer start
+            delta.literal(&buf[lit], pos - lit);
+            memmove(&buf[0], &buf[pos], len - pos);
+            len -= pos;
+            pos = lit = 0;
+
+            in.read(&buf[len], buf.size() - len);
+            const size_t count = static_cast<size_t>(in.gcount());
+            crc32.update(&buf[len], count);
+            len += count;
+            eof = !in;
+        }
+
+        const size_t avail = len - pos;
+        if (avail < blockSize) break; // tail at end of file
+
+        if (!sum.count)
+            sum.update(&buf[pos], blockSize);
+
+        // Weak sum lookup first, strong sum is checked on candidates only
+        Index_t::const_iterator it = std::lower_bound(index.begin(), index.end(),
+            std::make_pair(sum.digest(), UInt32(0)));
+        if (index.end() != it && it->first == sum.digest()) {
+            const std::string hash = strongSum(&buf[pos], blockSize);
+            for (; index.end() != it && it->first == sum.digest(); ++it)
+                if (strong[it->second] == hash) break;
+        }
+        if (index.end() != it && it->first == sum.digest()) {
+            delta.literal(&buf[lit], pos - lit);
+            delta.copy(UInt64(it->second) * blockSize, blockSize);
+            pos += blockSize;
+            lit = pos;
+            sum = RollSum();
+            continue;
+        }
+
+        if (avail == blockSize) break; // nothing to roll in at end of file
+        sum.rotate(buf[pos], buf[pos + blockSize]);
+        ++pos;
+        if (pos - lit >= MaxLiteral) {
+            delta.literal(&buf[lit], pos - lit);
+            lit = pos;
+        }
+    }
+    delta.literal(&buf[lit], len - lit);
+    return delta.end(crc32.checksum());
+}
+
+void BinaryDelta::patch(const std::string& base, const std::string& delta, const std::string& dst)
+{
+    Poco::FileInputStream bis(base, std::ios::in | std::ios::binary);
+    Poco::FileInputStream dis(delta, std::ios::in | std::ios::binary);
+    BinaryReader reader(dis, BinaryReader::LITTLE_ENDIAN_BYTE_ORDER);
+    readMagic(reader, DeltaMagic, delta);
+    Poco::FileOutputStream out(dst, std::ios::out | std::ios::trunc | std::ios::binary);
+    Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
+
+    std::vector<char> buffer(BufferSize);
+    for (;;) {
+        UInt8 op = 0;
+        reader >> op;
+        if (!dis.good())
+            throw Poco::DataFormatException("Unexpected end of delta " + delta);
+
+        UInt64 size = 0;
+        std::istream* src = &dis;
+        if (OpCopy == op) {
+            UInt64 offset;
+            reader >> offset >> size;
+            bis.clear();
+            bis.seekg(static_cast<std::streamoff>(offset));
+            src = &bis;
+        } else if (OpLiteral == op) {
+            UInt32 literal;
+            reader >> literal;
+            size = literal;
+        } else if (OpEnd == op) {
+            UInt32 expected;
+            reader >> expected;
+            if (crc32.checksum() != expected)
+                throw Poco::DataFormatException("Checksum mismatch after applying delta " + delta);
+            break;
+        } else
+            throw Poco::DataFormatException("Unknown operation in delta " + delta);
+
+        while (size) {
+            const size_t count = static_cast<size_t>(std::min<UInt64>(size, buffer.size()));
+            src->read(&buffer[0], count);
+            if (static_cast<size_t>(src->gcount()) != count)
+                throw Poco::DataFormatException("Truncated delta or base for " + delta);
+            crc32.update(&buffer[0], count);
+            out.write(&buffer[0], count);
+            size -= count;
+        }
+    }
+    out.close();
+}
@@ -0,0 +1,25 @@
+#ifndef BINARYDELTA_H
+#define BINARYDELTA_H
+
+#include <string>
+#include <Poco/Types.h>
+
+// rsync-like binary delta: signature of previous version is stored
+// instead of its content, new version is encoded as block copies
+// from previous one and literal data
+class BinaryDelta
+{
+public:
+    // Write block signature of src, chain is count of deltas since full version
+    static void signature(const std::string& src, const std::string& dst,
+                          unsigned blockSize, unsigned chain, unsigned crc32);
+    // Read signature header, false if signature is not availible
+    static bool header(const std::string& sig, unsigned& chain, unsigned& crc32);
+
+    // Encode src against signature, return size of written delta
+    static Poco::UInt64 encode(const std::string& sig, const std::string& src, const std::string& dst);
+    // Rebuild new version from previous one and delta
+    static void patch(const std::string& base, const std::string& delta, const std::string& dst);
+};
+
+#endif // BINARYDELTA_H
@@ -0,0 +1,88 @@
+#include "codec.h"
+#include "main.h"
+
+#include <cmath>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/String.h>
+#include <Poco/Mutex.h>
+#include <Poco/FileStream.h>
+
+namespace
+{
+    const std::streamsize SampleSize = 64 * 1024;
+}
+
+Codec::Codec(const std::string& name, const std::string& extension, const std::string& program) :
+    _name(name), _extension(extension), _program(program)
+{
+}
+
+std::string Codec::tarOption() const
+{
+    // tar adds -d to the program on extraction
+    return _program.empty() ? std::string() : Poco::format("--use-compress-program=\"%s\"", _program);
+}
+
+const Codec::List_t& Codec::all()
+{
+    static List_t codecs;
+    static Poco::FastMutex mutex;
+
+    Poco::FastMutex::ScopedLock lock(mutex);
+    if (codecs.empty()) {
+        codecs.push_back(Codec("none", ".tar", ""));
+        codecs.push_back(Codec("gzip", ".tar.gz", "gzip"));
+        codecs.push_back(Codec("lz4", ".tar.lz4", "lz4 -1"));
+        codecs.push_back(Codec("zstd-fast", ".tar.zst", "zstd -1 -T0"));
+        codecs.push_back(Codec("zstd", ".tar.zst", "zstd -19 -T0"));
+        codecs.push_back(Codec("xz", ".tar.xz", "xz -6 -T0"));
+    }
+    return codecs;
+}
+
+const Codec& Codec::none()
+{
+    return all().front();
+}
+
+const Codec& Codec::byName(const std::string& name)
+{
+    const List_t& codecs = all();
+    for (size_t i = 0, count = codecs.size(); i < count; ++i)
+        if (codecs[i].name() == name) return codecs[i];
+    throw Poco::NotFoundException("Unknown archive codec " + name);
+}
+
+const Codec* Codec::byArchive(const std::string& base)
+{
+    const List_t& codecs = all();
+    for (size_t i = 0, count = codecs.size(); i < count; ++i)
+        if (Poco::File(base + codecs[i].extension()).exists()) return &codecs[i];
+    return 0;
+}
+
+bool Codec::isCompressible(const std::string& path, const std::set<std::string>& skipExt, double maxEntropy)
+{
+    if (skipExt.count(Poco::toLower(App::lastToken(path, '.'))))
+        return false;
+
+    // Shannon entropy of sample in bits per byte
+    char buffer[SampleSize];
+    Poco::FileInputStream fis(path, std::ios::in | std::ios::binary);
+    fis.read(buffer, SampleSize);
+    const std::streamsize size = fis.gcount();
+    if (!size) return false;
+
+    size_t counts[256] = { 0 };
+    for (std::streamsize i = 0; i < size; ++i)
+        ++counts[static_cast<unsigned char>(buffer[i])];
+
+    double entropy = 0;
+    for (int i = 0; i < 256; ++i) {
+        if (!counts[i]) continue;
+        const double p = double(counts[i]) / size;
+        entropy -= p * std::log(p) / std::log(2.0);
+    }
+    return entropy < maxEntropy;
+}
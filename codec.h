@@ -0,0 +1,38 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+// Archive compression, codec of stored archive is recognized by its extension
+class Codec
+{
+public:
+    const std::string& name() const { return _name; }
+    const std::string& extension() const { return _extension; }
+    // tar option to pass archive through compression program
+    std::string tarOption() const;
+
+    static const Codec& none();
+    // Throws NotFoundException on unknown name
+    static const Codec& byName(const std::string& name);
+    // Codec of existing archive base + extension, 0 if not found
+    static const Codec* byArchive(const std::string& base);
+
+    // Estimate by extension rules and byte entropy of file beginning
+    static bool isCompressible(const std::string& path, const std::set<std::string>& skipExt,
+                               double maxEntropy);
+
+private:
+    typedef std::vector<Codec> List_t;
+
+    Codec(const std::string& name, const std::string& extension, const std::string& program);
+
+    static const List_t& all();
+
+private:
+    std::string _name, _extension, _program;
+};
+
+#endif // CODEC_H
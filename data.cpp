@@ -2,6 +2,8 @@
 #include "singleton.h"
 #include "main.h"
 
+#include <Poco/NumberParser.h>
+
 using Poco::Data::Statement;
 using Poco::Data::RecordSet;
 using Poco::Data::MySQL::Connector;
@@ -9,19 +11,24 @@ using Poco::Data::MySQL::Connector;
 class FileImpl : public Data::File
 {
 public:
-    // Select file columns position
-    enum { FileId, FileCrc32, FileFullName, FileIsDirectory, FileModifyDate };
+    // Select file columns position, timePoint is selected for trunk only
+    enum { FileId, FileCrc32, FileFullName, FileIsDirectory, FileModifyDate, FileTimePoint };
 
-    FileImpl(unsigned siteId, Data::Singleton::RecordSetPtr_t rs);
+    FileImpl(unsigned siteId, Data::TimePoint_t timePoint, Data::Singleton::RecordSetPtr_t rs);
 
     void setStatus(File::Status status);
+    void setModifyDate();
+    Version::List_t versions(Data::TimePoint_t tp) const;
 
 private:
     unsigned _siteId;
+    Data::TimePoint_t _timePoint;
 };
 
-FileImpl::FileImpl(unsigned siteId, Data::Singleton::RecordSetPtr_t rs) : _siteId(siteId)
+FileImpl::FileImpl(unsigned siteId, Data::TimePoint_t timePoint, Data::Singleton::RecordSetPtr_t rs) :
+    _siteId(siteId), _timePoint(timePoint)
 {
+    size = 0;
     if (!rs) return;
     id = rs->value(FileId).convert<unsigned>();
     crc32 = rs->value(FileCrc32).convert<unsigned>();
@@ -32,15 +39,42 @@ FileImpl::FileImpl(unsigned siteId, Data::Singleton::RecordSetPtr_t rs) : _siteI
 
 void FileImpl::setStatus(File::Status status)
 {
-    typedef void (Data::Singleton::*ImplMember_t)(unsigned, const File&);
+    typedef void (Data::Singleton::*ImplMember_t)(unsigned, Data::TimePoint_t, const File&);
     ImplMember_t im;
     switch (status) {
-        case File::Added:       im = &Data::Singleton::addFile; break;
+        case File::Added:
+            id = Data::Singleton::getInstance().addFile(_siteId, _timePoint, *this);
+            return;
         case File::Modified:    im = &Data::Singleton::updFile; break;
         case File::Deleted:     im = &Data::Singleton::delFile; break;
+        case File::Delta:       im = &Data::Singleton::deltaFile; break;
+        case File::Tombstone:   im = &Data::Singleton::tombstoneFile; break;
         default: throw Poco::LogicException("File::setStatus failed, unknown value");
     }
-    (Data::Singleton::getInstance().*im)(_siteId, *this);
+    (Data::Singleton::getInstance().*im)(_siteId, _timePoint, *this);
+}
+
+void FileImpl::setModifyDate()
+{
+    Data::Singleton::getInstance().touchFile(_siteId, _timePoint, *this);
+}
+
+Data::File::Version::List_t FileImpl::versions(Data::TimePoint_t tp) const
+{
+    // Select version columns position
+    enum { VersionTimePoint, VersionStatus };
+
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectVersions(id, tp);
+    if (!rs) return Version::List_t();
+
+    // One record to one version
+    int i = 0;
+    Version::List_t ret(rs->rowCount());
+    for (bool more = rs->moveFirst(); more; more = rs->moveNext(), ++i) {
+        ret[i].timePoint = rs->value(VersionTimePoint).convert<Data::TimePoint_t>();
+        ret[i].status = Status(rs->value(VersionStatus).convert<int>());
+    }
+    return ret;
 }
 
 //-----------------------------------------------------------------------------
@@ -64,6 +98,14 @@ IgnoreImpl::IgnoreImpl(Data::Singleton::RecordSetPtr_t rs)
         attribute = AttributeExt;
     else if (!Poco::icompare(std::string("path"), val))
         attribute = AttributePath;
+    else if (!Poco::icompare(std::string("glob"), val))
+        attribute = AttributeGlob;
+    else if (!Poco::icompare(std::string("regex"), val))
+        attribute = AttributeRegex;
+    else if (!Poco::icompare(std::string("size"), val))
+        attribute = AttributeSize;
+    else if (!Poco::icompare(std::string("age"), val))
+        attribute = AttributeAge;
 
     operand = rs->value(IgnoreOperand).convert<std::string>();
 }
@@ -71,28 +113,81 @@ IgnoreImpl::IgnoreImpl(Data::Singleton::RecordSetPtr_t rs)
 //-----------------------------------------------------------------------------
 class SiteImpl : public Data::Site
 {
-    Data::File::List_t files(Data::TimePoint_t tp) const;
+    typedef std::map<std::string, Data::TimePoint_t> Tombstones_t;
+    // Latest tombstone by directory name up to tp, 0 for all
+    Tombstones_t selectTombstones(Data::TimePoint_t tp) const;
+    // Directory above entry was deleted after this version of entry
+    static bool isBuried(const Tombstones_t& tombstones, const std::string& fullName, Data::TimePoint_t version);
+
+    Data::File::List_t files(Data::TimePoint_t tp, const std::string& prefix) const;
 
     Data::Ignore::List_t ignores() const;
 
+    Data::Generation generation() const;
+
     Data::File::Ptr_t createFile(const std::string& fullName,
                                  const std::string& modifyDate,
                                  bool isDirectory) const;
+
+    std::vector<Data::TimePoint_t> snapshots() const;
+    void addSnapshot(Data::TimePoint_t tp) const;
+    void delSnapshot(Data::TimePoint_t tp) const;
+
+    bool claimLease(const std::string& owner, int ttl, int age) const;
+    bool renewLease(const std::string& owner, int ttl) const;
+    void finishLease(const std::string& owner) const;
+    void releaseLease(const std::string& owner) const;
+
+    Data::StoredVersion::Map_t storedVersions() const;
+    void invalidateFile(unsigned fileId) const;
+    std::set<std::string> verifiedArchives(Data::TimePoint_t since) const;
+    void addVerification(const std::string& archive, Data::TimePoint_t checked,
+                         unsigned members, unsigned bad, const std::string& error) const;
 };
 
-Data::File::List_t SiteImpl::files(Data::TimePoint_t tp) const
+Data::File::List_t SiteImpl::files(Data::TimePoint_t tp, const std::string& prefix) const
 {
-    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectFiles(id, tp);
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectFiles(id, tp, prefix);
     if (!rs) return Data::File::List_t();
 
-    // One record to one file
-    int i = 0;
-    Data::File::List_t  ret(rs->rowCount());
-    for (bool more = rs->moveFirst(); more; more = rs->moveNext(), ++i)
-        ret[i].assign(new FileImpl(id, rs));
+    // Latest tombstone by directory name
+    const Tombstones_t tombstones = selectTombstones(tp);
+
+    // One record to one file, records older than tombstone above them are deleted
+    Data::File::List_t ret;
+    ret.reserve(rs->rowCount());
+    for (bool more = rs->moveFirst(); more; more = rs->moveNext()) {
+        if (!tombstones.empty()) {
+            const std::string fullName = rs->value(FileImpl::FileFullName).convert<std::string>();
+            const Data::TimePoint_t version = tp
+                ? Poco::NumberParser::parse64(rs->value(FileImpl::FileModifyDate).convert<std::string>())
+                : rs->value(FileImpl::FileTimePoint).convert<Data::TimePoint_t>();
+            if (isBuried(tombstones, fullName, version)) continue;
+        }
+        ret.push_back(Data::File::Ptr_t(new FileImpl(id, timePoint, rs)));
+    }
+    return ret;
+}
+
+SiteImpl::Tombstones_t SiteImpl::selectTombstones(Data::TimePoint_t tp) const
+{
+    Tombstones_t ret;
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectTombstones(id, tp);
+    if (rs)
+        for (bool more = rs->moveFirst(); more; more = rs->moveNext())
+            ret[rs->value(0).convert<std::string>()] = rs->value(1).convert<Data::TimePoint_t>();
     return ret;
 }
 
+bool SiteImpl::isBuried(const Tombstones_t& tombstones, const std::string& fullName, Data::TimePoint_t version)
+{
+    for (size_t pos = fullName.rfind('/'); pos && std::string::npos != pos; pos = fullName.rfind('/', pos - 1)) {
+        Tombstones_t::const_iterator it = tombstones.find(fullName.substr(0, pos));
+        if (tombstones.end() != it && it->second > version) return true;
+    }
+    return false;
+}
+
 Data::Ignore::List_t SiteImpl::ignores() const
 {
     Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectIgnores(id);
@@ -106,11 +201,16 @@ Data::Ignore::List_t SiteImpl::ignores() const
     return ret;
 }
 
+Data::Generation SiteImpl::generation() const
+{
+    return Data::Singleton::getInstance().selectGeneration(id);
+}
+
 Data::File::Ptr_t SiteImpl::createFile(const std::string& fullName,
     const std::string& modifyDate, bool isDirectory) const
 {
     Data::File::Ptr_t ret(
-        new FileImpl(id, Data::Singleton::RecordSetPtr_t()));
+        new FileImpl(id, timePoint, Data::Singleton::RecordSetPtr_t()));
 
     ret->id = 0;
     ret->crc32 = 0;
@@ -121,6 +221,109 @@ Data::File::Ptr_t SiteImpl::createFile(const std::string& fullName,
     return ret;
 }
 
+std::vector<Data::TimePoint_t> SiteImpl::snapshots() const
+{
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectSnapshots(id);
+    if (!rs) return std::vector<Data::TimePoint_t>();
+
+    int i = 0;
+    std::vector<Data::TimePoint_t> ret(rs->rowCount());
+    for (bool more = rs->moveFirst(); more; more = rs->moveNext(), ++i)
+        ret[i] = rs->value(0).convert<Data::TimePoint_t>();
+    return ret;
+}
+
+void SiteImpl::addSnapshot(Data::TimePoint_t tp) const
+{
+    Data::Singleton::getInstance().addSnapshot(id, tp);
+}
+
+void SiteImpl::delSnapshot(Data::TimePoint_t tp) const
+{
+    Data::Singleton::getInstance().delSnapshot(id, tp);
+}
+
+bool SiteImpl::claimLease(const std::string& owner, int ttl, int age) const
+{
+    return Data::Singleton::getInstance().claimLease(id, owner, ttl, age);
+}
+
+bool SiteImpl::renewLease(const std::string& owner, int ttl) const
+{
+    return Data::Singleton::getInstance().renewLease(id, owner, ttl);
+}
+
+void SiteImpl::finishLease(const std::string& owner) const
+{
+    Data::Singleton::getInstance().finishLease(id, owner);
+}
+
+void SiteImpl::releaseLease(const std::string& owner) const
+{
+    Data::Singleton::getInstance().releaseLease(id, owner);
+}
+
+Data::StoredVersion::Map_t SiteImpl::storedVersions() const
+{
+    // Select stored version columns position
+    enum { StoredFileId, StoredCrc32, StoredFullName, StoredTimePoint, StoredStatus, StoredChangeTime };
+
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectStored(id);
+    if (!rs) return Data::StoredVersion::Map_t();
+
+    // Rows of one file go together, the first one is the current version
+    Data::StoredVersion::Map_t ret;
+    Data::StoredVersion* version = 0;
+    unsigned fileId = 0;
+    bool chain = false; // previous row was delta, so this one is needed too
+    for (bool more = rs->moveFirst(); more; more = rs->moveNext()) {
+        const Data::File::Status status = Data::File::Status(rs->value(StoredStatus).convert<int>());
+        if (!version || rs->value(StoredFileId).convert<unsigned>() != fileId) {
+            fileId = rs->value(StoredFileId).convert<unsigned>();
+            version = &ret[rs->value(StoredFullName).convert<std::string>()];
+            version->fileId = fileId;
+            version->crc32 = rs->value(StoredCrc32).convert<unsigned>();
+            version->timePoint = rs->value(StoredTimePoint).convert<Data::TimePoint_t>();
+            version->status = status;
+            chain = true;
+        }
+        if (!chain) continue;
+        version->archives.push_back(rs->value(StoredChangeTime).convert<Data::TimePoint_t>());
+        chain = Data::File::Delta == status;
+    }
+
+    // Version older than tombstone above it is deleted, as in files()
+    const Tombstones_t tombstones = selectTombstones(0);
+    for (Data::StoredVersion::Map_t::iterator it = ret.begin(); !tombstones.empty() && it != ret.end(); )
+        if (isBuried(tombstones, it->first, it->second.timePoint))
+            ret.erase(it++);
+        else
+            ++it;
+    return ret;
+}
+
+void SiteImpl::invalidateFile(unsigned fileId) const
+{
+    Data::Singleton::getInstance().invalidateFile(fileId);
+}
+
+std::set<std::string> SiteImpl::verifiedArchives(Data::TimePoint_t since) const
+{
+    Data::Singleton::RecordSetPtr_t rs = Data::Singleton::getInstance().selectVerified(id, since);
+    if (!rs) return std::set<std::string>();
+
+    std::set<std::string> ret;
+    for (bool more = rs->moveFirst(); more; more = rs->moveNext())
+        ret.insert(rs->value(0).convert<std::string>());
+    return ret;
+}
+
+void SiteImpl::addVerification(const std::string& archive, Data::TimePoint_t checked,
+                               unsigned members, unsigned bad, const std::string& error) const
+{
+    Data::Singleton::getInstance().addVerification(id, archive, checked, members, bad, error);
+}
+
 //=============================================================================
 /*
     Data class contains singleton Impl instance
@@ -153,6 +356,7 @@ Data::Data()
             site->id = rs[0].extract<unsigned>();
             site->login = rs[1].extract<std::string>();
             site->password = rs[2].extract<std::string>();
+            site->timePoint = currentTimePoint();
             _sites[i] = site;
         }
     }
@@ -1,6 +1,8 @@
 #ifndef DATA_H
 #define DATA_H
 
+#include <set>
+#include <map>
 #include <vector>
 #include <Poco/DateTime.h>
 #include <Poco/SharedPtr.h>
@@ -16,20 +18,57 @@ public:
     Data();
     ~Data();
 
+    // Changes counter of site files, bumped by every change, and the latest timepoint
+    struct Generation
+    {
+        Poco::Int64 count;
+        TimePoint_t timePoint;
+    };
+
     struct File
     {
         typedef Poco::SharedPtr<File> Ptr_t;
         typedef std::vector<Ptr_t> List_t;
 
-        enum Status { Added = 0, Modified = 1, Deleted = -1 };
+        // Delta is modification stored as binary delta to previous version,
+        // Tombstone is deleted directory, entries under it older than it are deleted too
+        enum Status { Added = 0, Modified = 1, Deleted = -1, Delta = 2, Tombstone = -2 };
+
+        struct Version
+        {
+            typedef std::vector<Version> List_t;
+
+            TimePoint_t timePoint;
+            Status status;
+        };
 
         unsigned id, crc32;
         std::string fullName, modifyDate;
         bool isDirectory;
+        Poco::UInt64 size; // from listing if known, else 0
+        std::string unique; // MLSD unique fact from listing, empty if unknown
 
         virtual void setStatus(File::Status status) = 0;
+        // Content is the same, only modify date is stored
+        virtual void setModifyDate() = 0;
+        // History of file changes up to tp, latest first
+        virtual Version::List_t versions(TimePoint_t tp) const = 0;
 
-        bool isDeleted() const { return unsigned(Deleted) == crc32; }
+        bool isDeleted() const { return unsigned(Deleted) == crc32 || unsigned(Tombstone) == crc32; }
+        bool isDelta() const { return unsigned(Delta) == crc32; }
+    };
+
+    // Current version of stored file, its content is in archive of timePoint
+    // (or in later archives for Delta)
+    struct StoredVersion
+    {
+        typedef std::map<std::string, StoredVersion> Map_t; // by fullName
+
+        unsigned fileId, crc32;
+        TimePoint_t timePoint;
+        File::Status status;
+        // Archives content is built from, latest first: timePoint, older deltas and full base
+        std::vector<TimePoint_t> archives;
     };
 
     struct Ignore
@@ -37,7 +76,10 @@ public:
         typedef Poco::SharedPtr<Ignore> Ptr_t;
         typedef std::vector<Ptr_t> List_t;
 
-        enum Attribute { AttributeExt, AttributePath, CountOfAttributes };
+        // ext and path are exact, glob matches full name or base name, regex any part of full name,
+        // size (like 100M) and age (like 30d) limit files by MLSD facts
+        enum Attribute { AttributeExt, AttributePath, AttributeGlob, AttributeRegex,
+                         AttributeSize, AttributeAge, CountOfAttributes };
 
         Attribute attribute;
         std::string operand;
@@ -55,12 +97,37 @@ public:
 
         unsigned id;
         std::string login, password;
+        TimePoint_t timePoint; // timestamp of current backup run
 
-        virtual File::List_t files(TimePoint_t tp = 0) const = 0;
+        // Files at tp (trunk if 0), history is narrowed to names starting with prefix
+        virtual File::List_t files(TimePoint_t tp = 0, const std::string& prefix = std::string()) const = 0;
         virtual Ignore::List_t ignores()  const = 0;
+        virtual Generation generation() const = 0;
         virtual File::Ptr_t createFile(const std::string& fullName,
                                        const std::string& modifyDate,
                                        bool isDirectory) const = 0;
+
+        // Timepoints of synthetic full snapshots, ascending
+        virtual std::vector<TimePoint_t> snapshots() const = 0;
+        virtual void addSnapshot(TimePoint_t tp) const = 0;
+        virtual void delSnapshot(TimePoint_t tp) const = 0;
+
+        // Lease of the site for owner instance: claim fails if other instance holds it
+        // or site was finished less than age seconds ago, renew fails if lease is lost
+        virtual bool claimLease(const std::string& owner, int ttl, int age) const = 0;
+        virtual bool renewLease(const std::string& owner, int ttl) const = 0;
+        // Successful run marks site finished, failed one only gives lease back
+        virtual void finishLease(const std::string& owner) const = 0;
+        virtual void releaseLease(const std::string& owner) const = 0;
+
+        // Regular files with their current versions, ones buried under later tombstone are not listed
+        virtual StoredVersion::Map_t storedVersions() const = 0;
+        // Next run downloads file again and stores its full version
+        virtual void invalidateFile(unsigned fileId) const = 0;
+        // Archives (names without codec extension) verified without errors since tp
+        virtual std::set<std::string> verifiedArchives(TimePoint_t since) const = 0;
+        virtual void addVerification(const std::string& archive, TimePoint_t checked,
+                                     unsigned members, unsigned bad, const std::string& error) const = 0;
     };
 
     const Site::List_t& sites() const { return _sites; }
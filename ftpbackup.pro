@@ -8,7 +8,19 @@ SOURCES += main.cpp \
     data.cpp \
     backuptask.cpp \
     ftpclient.cpp \
-    singleton.cpp
+    singleton.cpp \
+    binarydelta.cpp \
+    codec.cpp \
+    archivereader.cpp \
+    ignorematcher.cpp \
+    globautomaton.cpp \
+    listparser.cpp \
+    manifest.cpp \
+    journal.cpp \
+    ringchannel.cpp \
+    replicator.cpp \
+    tracer.cpp \
+    scanscheduler.cpp
 INCLUDEPATH += /usr/include/mysql
 CONFIG(debug, debug|release):LIBS += -lPocoFoundationd \
     -lPocoUtild \
@@ -20,10 +32,24 @@ else:LIBS += -lPocoFoundation \
     -lPocoNet \
     -lPocoData \
     -lPocoMySQL
+LIBS += -lzstd
 HEADERS += data.h \
     backuptask.h \
     main.h \
     ftpclient.h \
-    singleton.h
+    singleton.h \
+    binarydelta.h \
+    codec.h \
+    archivereader.h \
+    ignorematcher.h \
+    globautomaton.h \
+    listparser.h \
+    manifest.h \
+    journal.h \
+    ringchannel.h \
+    replicator.h \
+    tracer.h \
+    scanscheduler.h
 OTHER_FILES += README \
+    schema.sql \
     config.properties
@@ -1,4 +1,5 @@
 #include "ftpclient.h"
+#include "tracer.h"
 #include "main.h"
 
 #include <memory.h>
@@ -15,13 +16,15 @@ using Poco::Net::SocketStream;
 using Poco::Net::FTPClientSession;
 
 BackupTask::FtpClient::FtpClient(const std::string& host, Poco::UInt16 port) :
-    FTPClientSession(host, port), _parentData(0)
+    FTPClientSession(host, port), _parentData(0), _compressed(false), _dataStart(0)
 {
 }
 
 void BackupTask::FtpClient::login(const std::string& user, const std::string& pass)
 {
+    Tracer::Span span("ftp", "login");
     FTPClientSession::login(user, pass);
+    _home = getWorkingDirectory();
     if (_parentData) return; // initialize pointer after authorization
 
     // Perform hardcore hacking
@@ -39,6 +42,37 @@ void BackupTask::FtpClient::login(const std::string& user, const std::string& pa
 
 }
 
+bool BackupTask::FtpClient::rewind()
+{
+    try { setWorkingDirectory(_home); }
+    catch (Poco::Exception&) { return false; }
+    return true;
+}
+
+int BackupTask::FtpClient::sendCommand(const std::string& command, std::string& response)
+{
+    Tracer::Span span("ftp", command);
+    return FTPClientSession::sendCommand(command, response);
+}
+
+int BackupTask::FtpClient::sendCommand(const std::string& command, const std::string& arg, std::string& response)
+{
+    Tracer::Span span("ftp", command + " " + arg);
+    return FTPClientSession::sendCommand(command, arg, response);
+}
+
+void BackupTask::FtpClient::setWorkingDirectory(const std::string& path)
+{
+    Tracer::Span span("ftp", "CWD " + path);
+    FTPClientSession::setWorkingDirectory(path);
+}
+
+void BackupTask::FtpClient::cdup()
+{
+    Tracer::Span span("ftp", "CDUP");
+    FTPClientSession::cdup();
+}
+
 bool BackupTask::FtpClient::hasFeature(Feature feature)
 {
     if (_features.empty()) {
@@ -46,6 +80,8 @@ bool BackupTask::FtpClient::hasFeature(Feature feature)
         std::vector<std::string> commands(FeatureCount);
         commands[MLSD] = "MLSD";
         commands[MDTM] = "MDTM";
+        commands[XCRC] = "XCRC";
+        commands[MODEZ] = "MODE Z";
 
         sendCommand("FEAT", response);
         _features.resize(FeatureCount);
@@ -56,21 +92,71 @@ bool BackupTask::FtpClient::hasFeature(Feature feature)
     return _features[feature];
 }
 
+bool BackupTask::FtpClient::enableCompression()
+{
+    if (_compressed) return true;
+    if (!hasFeature(MODEZ)) return false;
+
+    std::string response;
+    _compressed = isPositiveCompletion(sendCommand("MODE Z", response));
+    return _compressed;
+}
+
+std::istream& BackupTask::FtpClient::beginData(std::istream& data, const std::string& name, Poco::Int64 start)
+{
+    if (start) {
+        // PASV, connect and command reply
+        Tracer::complete("data", name + " connect", start);
+        _dataName = name;
+        _dataStart = Tracer::now();
+        data.peek();
+        Tracer::complete("data", name + " first byte", _dataStart);
+        _dataStart = Tracer::now();
+    }
+
+    if (!_compressed) return data;
+    // Every transfer is one zlib stream
+    _inflater.reset(new Poco::InflatingInputStream(data, Poco::InflatingStreamBuf::STREAM_ZLIB));
+    return *_inflater;
+}
+
+void BackupTask::FtpClient::endData()
+{
+    _inflater.reset();
+    if (!_dataStart) return;
+    Tracer::complete("data", _dataName + " transfer", _dataStart);
+    _dataStart = 0;
+}
+
 std::istream& BackupTask::FtpClient::beginMLSD(const std::string& path)
 {
     if (!_parentData) return beginList(path);
+    const Poco::Int64 start = Tracer::enabled() ? Tracer::now() : 0;
     // Same implementation as FTPClientSession::beginList
     delete *_parentData;
     *_parentData = 0;
     *_parentData = new SocketStream(establishDataConnection("MLSD", path));
-    return **_parentData;
+    return beginData(**_parentData, "MLSD " + path, start);
 }
 
 void BackupTask::FtpClient::endMLSD()
 {
+    endData();
     endTransfer();
 }
 
+std::istream& BackupTask::FtpClient::beginList(const std::string& path, bool extended)
+{
+    const Poco::Int64 start = Tracer::enabled() ? Tracer::now() : 0;
+    return beginData(FTPClientSession::beginList(path, extended), (extended ? "LIST " : "NLST ") + path, start);
+}
+
+void BackupTask::FtpClient::endList()
+{
+    endData();
+    FTPClientSession::endList();
+}
+
 unsigned BackupTask::FtpClient::download(const std::string& src, const std::string& dst)
 {
     Poco::File(Poco::Path(dst).parent()).createDirectories();
@@ -78,16 +164,43 @@ unsigned BackupTask::FtpClient::download(const std::string& src, const std::stri
     Poco::Checksum crc32(Poco::Checksum::TYPE_CRC32);
     Poco::FileOutputStream fstream(dst, std::ios::out | std::ios::trunc | std::ios::binary);
 
-    // Read each byte and calculate checksum
-    std::istream& data = beginDownload(src);
+    // Read each byte and calculate checksum, of inflated content in MODE Z
+    const Poco::Int64 start = Tracer::enabled() ? Tracer::now() : 0;
+    std::istream& data = beginData(beginDownload(src), "RETR " + src, start);
     for (char byte = data.get(); !data.eof(); byte = data.get()) {
         crc32.update(byte);
         fstream << byte;
     }
+    endData();
     endDownload();
     return crc32.checksum();
 }
 
+bool BackupTask::FtpClient::modifyTime(const std::string& path, std::string& modify)
+{
+    if (!hasFeature(MDTM)) return false;
+
+    // Reply is "213 YYYYMMDDHHMMSS[.sss]"
+    std::string response;
+    if (!isPositiveCompletion(sendCommand("MDTM", path, response)) || response.size() < 18)
+        return false;
+    modify = response.substr(4, 14);
+    return true;
+}
+
+bool BackupTask::FtpClient::checksum(const std::string& path, unsigned& crc32)
+{
+    if (!hasFeature(XCRC)) return false;
+
+    // Reply is "250 <hex crc32>", some servers add file name after it
+    std::string response;
+    if (!isPositiveCompletion(sendCommand("XCRC", path, response)))
+        return false;
+    Poco::StringTokenizer tok(response, " ",
+        Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+    return tok.count() > 1 && Poco::NumberParser::tryParseHex(tok[1], crc32);
+}
+
 void BackupTask::FtpClient::upload(const std::string& src)
 {
     std::string dst = App::lastToken(src, Poco::Path::separator());
@@ -137,21 +250,13 @@ void BackupTask::FtpClient::removeAll(const std::string& path)
 
 BackupTask::FtpClient *BackupTask::FtpClient::createConnect()
 {
-    static std::string host;
-    static Poco::UInt16 port = 0;
-    static int timeout = 0;
-    static Poco::FastMutex mutex;
-
-    if (!port) { // parse properties once
-        Poco::FastMutex::ScopedLock lock(mutex); // lock to another threads
-        Poco::StringTokenizer tok(App::config("ftp.connection"), ":");
-        if (0 == tok.count())
-            throw Poco::ApplicationException("Invalid ftp config property");
-        host = tok[0];
-        port = 2 == tok.count() ? Poco::NumberParser::parse(tok[1]) : FTPClientSession::FTP_PORT;
-
-        timeout = Poco::NumberParser::parse(App::config("ftp.timeout", "0"));
-    }
+    // Properties are parsed on every connect to follow configuration reload
+    Poco::StringTokenizer tok(App::config("ftp.connection"), ":");
+    if (0 == tok.count())
+        throw Poco::ApplicationException("Invalid ftp config property");
+    const std::string host = tok[0];
+    const Poco::UInt16 port = 2 == tok.count() ? Poco::NumberParser::parse(tok[1]) : FTPClientSession::FTP_PORT;
+    const int timeout = Poco::NumberParser::parse(App::config("ftp.timeout", "0"));
 
     FtpClient *ret = new FtpClient(host, port);
     if (timeout)
@@ -2,6 +2,8 @@
 #define FTPCLIENT_H
 
 #include "backuptask.h"
+#include <memory>
+#include <Poco/InflatingStream.h>
 #include <Poco/Net/FTPClientSession.h>
 #include <Poco/Net/SocketStream.h>
 
@@ -9,15 +11,33 @@ class BackupTask::FtpClient : public Poco::Net::FTPClientSession
 {
 public:
     void login(const std::string& user, const std::string& pass);
+    // Check session is alive and return to directory used after login
+    bool rewind();
 
-    enum Feature { MLSD, MDTM, FeatureCount };
+    // Same as FTPClientSession ones, traced
+    int sendCommand(const std::string& command, std::string& response);
+    int sendCommand(const std::string& command, const std::string& arg, std::string& response);
+    void setWorkingDirectory(const std::string& path);
+    void cdup();
+
+    enum Feature { MLSD, MDTM, XCRC, MODEZ, FeatureCount };
     bool hasFeature(Feature feature);
+    // Switch to MODE Z if server supports it, listings and downloads are inflated then.
+    // Uploads are not deflated, so session used to upload must not call it
+    bool enableCompression();
 
     std::istream& beginMLSD(const std::string& path = "");
     void endMLSD();
+    // Same as FTPClientSession ones, but inflate compressed transfer
+    std::istream& beginList(const std::string& path = "", bool extended = false);
+    void endList();
 
     // Return crc32 of downloaded file content
     unsigned download(const std::string& src, const std::string& dst);
+    // YYYYMMDDHHMMSS UTC modify time of file (MDTM), false if it is not available
+    bool modifyTime(const std::string& path, std::string& modify);
+    // Crc32 of file computed by server (XCRC), false if it is not available
+    bool checksum(const std::string& path, unsigned& crc32);
     // Recursively upload files
     void upload(const std::string& src);
     // Recursively remove files
@@ -27,10 +47,19 @@ public:
 
 private:
     FtpClient(const std::string& host, Poco::UInt16 port);
+    // Data stream as is or inflater reading it in MODE Z. Opening of connection
+    // since start and wait for first byte are traced, transfer is till endData()
+    std::istream& beginData(std::istream& data, const std::string& name, Poco::Int64 start);
+    void endData();
 
 private:
     Poco::Net::SocketStream**  _parentData;
     std::vector<bool> _features;
+    bool _compressed;
+    std::auto_ptr<Poco::InflatingInputStream> _inflater; // of current transfer
+    std::string _dataName; // traced transfer
+    Poco::Int64 _dataStart;
+    std::string _home;
 };
 
 #endif // FTPCLIENT_H
@@ -0,0 +1,140 @@
+#include "globautomaton.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Enough for hundreds of globs, subject adds at most one state per char
+    const size_t MaxStates = 4096;
+}
+
+GlobAutomaton::GlobAutomaton(const std::vector<std::string>& globs) : _classCount(0), _start(0), _dead(0)
+{
+    for (size_t i = 0, count = globs.size(); i < count; ++i)
+        parse(globs[i]);
+    classify();
+    reset();
+}
+
+void GlobAutomaton::parse(const std::string& glob)
+{
+    _starts.push_back(static_cast<unsigned>(_tokens.size()));
+    for (size_t i = 0, count = glob.size(); i < count; ++i) {
+        Token token;
+        token.repeat = token.final = false;
+        const char c = glob[i];
+        const size_t end = '[' == c ? glob.find(']', i + 1) : std::string::npos;
+        if ('*' == c) {
+            token.chars.set();
+            token.repeat = true;
+        } else if ('?' == c)
+            token.chars.set();
+        else if (std::string::npos != end) {
+            // Set of chars and ranges, [!set] or [^set] is its complement, '[' without ']' is literal
+            size_t j = i + 1;
+            const bool negate = j < end && ('!' == glob[j] || '^' == glob[j]);
+            if (negate) ++j;
+            for (; j < end; ++j) {
+                if ('\\' == glob[j] && j + 1 < end) ++j;
+                const unsigned char first = glob[j];
+                if (j + 2 < end && '-' == glob[j + 1]) {
+                    for (unsigned ch = first, last = static_cast<unsigned char>(glob[j + 2]); ch <= last; ++ch)
+                        token.chars.set(ch);
+                    j += 2;
+                } else
+                    token.chars.set(first);
+            }
+            if (negate) token.chars.flip();
+            i = end;
+        } else
+            token.chars.set(static_cast<unsigned char>(c));
+        _tokens.push_back(token);
+    }
+
+    Token final;
+    final.repeat = false;
+    final.final = true;
+    _tokens.push_back(final);
+}
+
+void GlobAutomaton::classify()
+{
+    // Every distinct set of chars splits classes into chars inside and outside of it
+    std::fill(_classes, _classes + 256, 0);
+    _classCount = 1;
+    for (size_t t = 0, count = _tokens.size(); t < count; ++t) {
+        const std::bitset<256>& chars = _tokens[t].chars;
+        if (chars.none() || chars.all()) continue;
+        std::map<std::pair<unsigned char, bool>, unsigned char> split;
+        for (unsigned c = 0; c < 256; ++c) {
+            const std::pair<unsigned char, bool> key(_classes[c], chars[c]);
+            std::map<std::pair<unsigned char, bool>, unsigned char>::const_iterator it = split.find(key);
+            if (split.end() == it)
+                it = split.insert(std::make_pair(key, static_cast<unsigned char>(split.size()))).first;
+            _classes[c] = it->second;
+        }
+        _classCount = static_cast<unsigned>(split.size());
+    }
+}
+
+void GlobAutomaton::reset()
+{
+    _states.clear();
+    _index.clear();
+    Positions_t positions;
+    _dead = state(positions);
+    positions = _starts;
+    _start = state(positions);
+}
+
+int GlobAutomaton::state(Positions_t& positions)
+{
+    // * may match nothing, position after it is reached too
+    for (size_t i = 0; i < positions.size(); ++i)
+        if (_tokens[positions[i]].repeat) positions.push_back(positions[i] + 1);
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    std::map<Positions_t, int>::const_iterator it = _index.find(positions);
+    if (_index.end() != it) return it->second;
+
+    State state;
+    state.positions = positions;
+    state.accept = false;
+    for (size_t i = 0, count = positions.size(); i < count && !state.accept; ++i)
+        state.accept = _tokens[positions[i]].final;
+    state.next.assign(_classCount, -1);
+    _states.push_back(state);
+    const int ret = static_cast<int>(_states.size() - 1);
+    _index[positions] = ret;
+    return ret;
+}
+
+int GlobAutomaton::transition(int from, unsigned char c)
+{
+    Positions_t next;
+    const Positions_t& positions = _states[from].positions;
+    for (size_t i = 0, count = positions.size(); i < count; ++i) {
+        const Token& token = _tokens[positions[i]];
+        if (!token.final && token.chars[c])
+            next.push_back(token.repeat ? positions[i] : positions[i] + 1);
+    }
+    return state(next);
+}
+
+bool GlobAutomaton::match(const char* begin, const char* end)
+{
+    if (_states.size() > MaxStates) reset();
+
+    int current = _start;
+    for (const char* p = begin; p != end && current != _dead; ++p) {
+        const unsigned char c = static_cast<unsigned char>(*p);
+        int next = _states[current].next[_classes[c]];
+        if (next < 0) {
+            next = transition(current, c);
+            _states[current].next[_classes[c]] = next;
+        }
+        current = next;
+    }
+    return _states[current].accept;
+}
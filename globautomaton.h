@@ -0,0 +1,57 @@
+#ifndef GLOBAUTOMATON_H
+#define GLOBAUTOMATON_H
+
+#include <map>
+#include <bitset>
+#include <string>
+#include <vector>
+
+// Set of globs matched in one pass over subject by DFA built lazily from their NFA.
+// Glob has * (any string), ? (any char), [set] or [!set] and literal chars, all of
+// them match '/' too. DFA state is the set of glob positions reached, it is built on
+// the first transition into it, so literal globs and prefixes form a trie and each
+// char of subject costs one table lookup once the automaton is warm
+class GlobAutomaton
+{
+public:
+    explicit GlobAutomaton(const std::vector<std::string>& globs);
+
+    // Whole subject matches any of globs
+    bool match(const char* begin, const char* end);
+    bool match(const std::string& subject) { return match(subject.data(), subject.data() + subject.size()); }
+
+private:
+    struct Token
+    {
+        std::bitset<256> chars;
+        bool repeat; // *, stays at the same position
+        bool final; // end of glob, matches nothing
+    };
+    typedef std::vector<unsigned> Positions_t; // of tokens, sorted
+    struct State
+    {
+        Positions_t positions;
+        bool accept;
+        std::vector<int> next; // by char class, -1 until built
+    };
+
+    void parse(const std::string& glob);
+    // Chars no token tells apart share one class and one column of transitions
+    void classify();
+    // Existing or new state of positions and all reachable from them without input
+    int state(Positions_t& positions);
+    int transition(int from, unsigned char c);
+    // Built states are dropped when there are too many of them
+    void reset();
+
+private:
+    std::vector<Token> _tokens;
+    Positions_t _starts;
+    unsigned char _classes[256];
+    unsigned _classCount;
+    std::vector<State> _states;
+    std::map<Positions_t, int> _index;
+    int _start, _dead;
+};
+
+#endif // GLOBAUTOMATON_H
@@ -0,0 +1,205 @@
+#include "ignorematcher.h"
+#include "main.h"
+
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <Poco/Timestamp.h>
+#include <Poco/DateTimeFormatter.h>
+
+namespace
+{
+    // Glob to regex matched against full name, * and ? cross separator
+    std::string globToRegex(const std::string& glob)
+    {
+        std::string ret;
+        for (size_t i = 0, count = glob.size(); i < count; ++i) {
+            const char c = glob[i];
+            if ('*' == c) ret += ".*";
+            else if ('?' == c) ret += ".";
+            else if ('[' == c) {
+                const size_t end = glob.find(']', i + 1);
+                if (std::string::npos == end) {
+                    ret += "\\[";
+                    continue;
+                }
+                std::string cls = glob.substr(i + 1, end - i - 1);
+                if (!cls.empty() && '!' == cls[0]) cls[0] = '^';
+                ret += '[' + cls + ']';
+                i = end;
+            } else {
+                if (!isalnum(static_cast<unsigned char>(c)) && '/' != c) ret += '\\';
+                ret += c;
+            }
+        }
+        return ret;
+    }
+
+    // Number with optional unit suffix, 0 on error
+    Poco::UInt64 parseQuantity(const std::string& value, const std::string& units, const Poco::UInt64* factors)
+    {
+        char* end = 0;
+        const Poco::UInt64 number = strtoull(value.c_str(), &end, 10);
+        if (end == value.c_str()) return 0;
+        if (!*end) return number;
+        const size_t unit = units.find(tolower(*end));
+        if (std::string::npos == unit || end[1]) return 0;
+        return number * factors[unit];
+    }
+}
+
+IgnoreMatcher::IgnoreMatcher() : _maxSize(0)
+{
+}
+
+void IgnoreMatcher::compile(const Data::Ignore::List_t& ignores, Data::TimePoint_t now)
+{
+    static const Poco::UInt64 sizeFactors[] = { 1, 1ULL << 10, 1ULL << 20, 1ULL << 30 };
+    static const Poco::UInt64 ageFactors[] = { 1, 60, 3600, 86400 };
+
+    _exts.clear();
+    _paths.clear();
+    _baseGlobs.reset();
+    _fullGlobs.reset();
+    _regexes.reset();
+    _maxSize = 0;
+    _minModify.clear();
+
+    // Globs without separator match base name, others the full name
+    std::vector<std::string> baseNames, fullNames;
+    std::string regexes;
+    Poco::UInt64 maxAge = 0;
+    for (size_t i = 0, count = ignores.size(); i < count; ++i) {
+        const Data::Ignore& ign = *ignores[i];
+        if (!ign.isValid()) continue;
+
+        switch (ign.attribute) {
+        case Data::Ignore::AttributeExt:
+            _exts.insert(ign.operand);
+            break;
+        case Data::Ignore::AttributePath:
+            _paths.insert(ign.operand);
+            break;
+        case Data::Ignore::AttributeGlob:
+            (std::string::npos != ign.operand.find('/') ? fullNames : baseNames).push_back(ign.operand);
+            break;
+        case Data::Ignore::AttributeRegex:
+            try {
+                Poco::RegularExpression test(ign.operand, 0, false);
+                regexes += "|(?:" + ign.operand + ")";
+            } catch (Poco::Exception& ex) {
+                App::logger().warning("Skip invalid ignore regex " + ign.operand + ": " + ex.displayText());
+            }
+            break;
+        case Data::Ignore::AttributeSize: {
+            const Poco::UInt64 size = parseQuantity(ign.operand, "bkmg", sizeFactors);
+            if (!size)
+                App::logger().warning("Skip invalid ignore size " + ign.operand);
+            else if (!_maxSize || size < _maxSize)
+                _maxSize = size;
+            break;
+        }
+        case Data::Ignore::AttributeAge: {
+            const Poco::UInt64 age = parseQuantity(ign.operand, "smhd", ageFactors);
+            if (!age)
+                App::logger().warning("Skip invalid ignore age " + ign.operand);
+            else if (!maxAge || age < maxAge)
+                maxAge = age;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    if (!baseNames.empty()) _baseGlobs.reset(new GlobAutomaton(baseNames));
+    if (!fullNames.empty()) _fullGlobs.reset(new GlobAutomaton(fullNames));
+    if (!regexes.empty())
+        _regexes.reset(new Poco::RegularExpression(regexes.substr(1)));
+
+    // Modify facts are compared as strings of the same format
+    if (maxAge)
+        _minModify = Poco::DateTimeFormatter::format(
+            Poco::Timestamp(now - Data::TimePoint_t(maxAge) * Poco::Timestamp::resolution()), "%Y%m%d%H%M%S");
+}
+
+bool IgnoreMatcher::matchName(const std::string& fullName)
+{
+    const size_t slash = fullName.rfind('/');
+    const size_t base = std::string::npos == slash ? 0 : slash + 1;
+    if (!_exts.empty()) {
+        // Extension of base name or whole base name without dot, as App::lastToken() gives
+        const size_t dot = fullName.rfind('.');
+        _ext.assign(fullName, std::string::npos != dot && dot >= base ? dot + 1 : base, std::string::npos);
+        if (_exts.count(_ext)) return true;
+    }
+    const char* name = fullName.data();
+    if (_baseGlobs.get() && _baseGlobs->match(name + base, name + fullName.size())) return true;
+    if (_fullGlobs.get() && _fullGlobs->match(fullName)) return true;
+    // Search, not whole subject match: regex rules match any part of full name
+    Poco::RegularExpression::Match match;
+    return _regexes.get() && _regexes->match(fullName, 0, match) > 0;
+}
+
+bool IgnoreMatcher::matchFacts(const std::string& size, const std::string& modify) const
+{
+    if (_maxSize && !size.empty() && strtoull(size.c_str(), 0, 10) > _maxSize)
+        return true;
+    // LIST date of minute or day precision is compared at its own
+    const size_t precision = std::min(modify.size(), _minModify.size());
+    return !_minModify.empty() && precision >= 8 &&
+        modify.compare(0, precision, _minModify, 0, precision) < 0;
+}
+
+PathFilter::PathFilter(const std::vector<std::string>& patterns) : _wholeSite(false)
+{
+    std::string list;
+    bool first = true;
+    for (size_t i = 0, count = patterns.size(); i < count; ++i) {
+        std::string pattern = patterns[i];
+        if (pattern.empty()) continue;
+        if ('/' != pattern[0]) pattern.insert(0, 1, '/');
+        while (!pattern.empty() && '/' == pattern[pattern.size() - 1])
+            pattern.erase(pattern.size() - 1);
+        if (pattern.empty()) {
+            // "/" is whole site, other patterns add nothing to it
+            _wholeSite = true;
+            _prefix.clear();
+            _names.reset();
+            return;
+        }
+
+        const std::string literal = pattern.substr(0, pattern.find_first_of("*?["));
+        if (first)
+            _prefix = literal;
+        else {
+            size_t n = 0;
+            while (n < _prefix.size() && n < literal.size() && _prefix[n] == literal[n]) ++n;
+            _prefix.erase(n);
+        }
+        list += (first ? "" : "|") + globToRegex(pattern);
+        first = false;
+    }
+
+    // Matched directory brings its whole subtree
+    if (!first)
+        _names.reset(new Poco::RegularExpression("^(?:" + list + ")(?:/.*)?$"));
+}
+
+PathFilter::PathFilter(const std::set<std::string>& names) : _exact(names), _wholeSite(false)
+{
+    if (names.empty()) return;
+    // Sorted, so prefix common to the first and the last name is common to all
+    const std::string& first = *names.begin();
+    const std::string& last = *names.rbegin();
+    size_t n = 0;
+    while (n < first.size() && n < last.size() && first[n] == last[n]) ++n;
+    _prefix = first.substr(0, n);
+}
+
+bool PathFilter::match(const std::string& fullName) const
+{
+    if (_wholeSite) return true;
+    if (!_exact.empty()) return _exact.count(fullName) > 0;
+    return !_names.get() || _names->match(fullName);
+}
@@ -0,0 +1,60 @@
+#ifndef IGNOREMATCHER_H
+#define IGNOREMATCHER_H
+
+#include "data.h"
+#include "globautomaton.h"
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Poco/Types.h>
+#include <Poco/RegularExpression.h>
+
+// Ignore rules of site compiled once per run: exact rules go to sets,
+// glob ones to automatons of base and full names, regex ones to single regular expression
+class IgnoreMatcher
+{
+public:
+    IgnoreMatcher();
+
+    // Invalid rules are logged and skipped, age rules are relative to now
+    void compile(const Data::Ignore::List_t& ignores, Data::TimePoint_t now);
+
+    // Entry of listing is skipped by its full name, directory is not listed then
+    bool matchName(const std::string& fullName);
+    // Size and modify (YYYYMMDDHHMMSS, UTC) facts of file, empty if unknown
+    bool matchFacts(const std::string& size, const std::string& modify) const;
+    // Directory is recorded but its content is not listed
+    bool prunePath(const std::string& path) const { return _paths.count(path) > 0; }
+
+private:
+    std::set<std::string> _exts, _paths;
+    std::auto_ptr<GlobAutomaton> _baseGlobs, _fullGlobs;
+    std::auto_ptr<Poco::RegularExpression> _regexes;
+    Poco::UInt64 _maxSize; // 0 if not limited
+    std::string _minModify; // empty if not limited
+    std::string _ext; // buffer of checked extension
+};
+
+// Restore filter: entries under any of paths, globs are matched against full name
+class PathFilter
+{
+public:
+    explicit PathFilter(const std::vector<std::string>& patterns);
+    // Exact full names, without globs and subtrees
+    explicit PathFilter(const std::set<std::string>& names);
+
+    // Nothing is filtered out
+    bool empty() const { return _wholeSite || (!_names.get() && _exact.empty()); }
+    // Literal prefix common to all patterns, narrows metadata query
+    const std::string& prefix() const { return _prefix; }
+    bool match(const std::string& fullName) const;
+
+private:
+    std::auto_ptr<Poco::RegularExpression> _names;
+    std::set<std::string> _exact;
+    std::string _prefix;
+    bool _wholeSite; // "/" is among patterns, everything matches
+};
+
+#endif // IGNOREMATCHER_H
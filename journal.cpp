@@ -0,0 +1,58 @@
+#include "journal.h"
+
+#include <Poco/File.h>
+#include <Poco/NumberParser.h>
+#include <Poco/StringTokenizer.h>
+
+namespace
+{
+    // Fields are tab separated, name is the last one
+    const char Stored = 'S', Committed = 'C';
+}
+
+Journal::Journal(const std::string& path) :
+    _out(path, std::ios::out | std::ios::app | std::ios::binary)
+{
+}
+
+void Journal::stored(const Data::File& file, Data::File::Status status, const std::string& signature)
+{
+    _out << Stored << '\t' << int(status) << '\t' << file.crc32 << '\t' << file.modifyDate << '\t'
+         << signature << '\t' << file.fullName << '\n';
+    _out.flush(); // record survives killed process
+}
+
+void Journal::committed(const Data::File& file)
+{
+    _out << Committed << "\t\t\t\t\t" << file.fullName << '\n';
+    _out.flush();
+}
+
+void Journal::read(const std::string& path, Record::Map_t& records)
+{
+    if (!Poco::File(path).exists()) return;
+
+    Poco::FileInputStream in(path, std::ios::in | std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (in.eof()) break; // record torn by crash has no line end
+        Poco::StringTokenizer tok(line, "\t");
+        if (6 != tok.count() || 1 != tok[0].size()) continue;
+
+        if (Committed == tok[0][0]) {
+            Record::Map_t::iterator it = records.find(tok[5]);
+            if (records.end() != it) it->second.committed = true;
+        } else if (Stored == tok[0][0]) {
+            int status;
+            unsigned crc32;
+            if (!Poco::NumberParser::tryParse(tok[1], status) || !Poco::NumberParser::tryParseUnsigned(tok[2], crc32))
+                continue;
+            Record& rec = records[tok[5]];
+            rec.committed = false;
+            rec.status = Data::File::Status(status);
+            rec.crc32 = crc32;
+            rec.modifyDate = tok[3];
+            rec.signature = tok[4];
+        }
+    }
+}
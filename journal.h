@@ -0,0 +1,37 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "data.h"
+#include <map>
+#include <string>
+#include <Poco/FileStream.h>
+
+// Append only log of backup run: files stored in working directory and
+// files committed to database. It is left on disk if run is interrupted.
+class Journal
+{
+public:
+    struct Record
+    {
+        typedef std::map<std::string, Record> Map_t; // by fullName
+
+        bool committed;
+        Data::File::Status status;
+        unsigned crc32;
+        std::string modifyDate, signature; // signature is pending one, empty if none
+    };
+
+    explicit Journal(const std::string& path);
+
+    // File content is in working directory, signature is not yet renamed
+    void stored(const Data::File& file, Data::File::Status status, const std::string& signature);
+    void committed(const Data::File& file);
+
+    // Read records, the latest one of each file wins
+    static void read(const std::string& path, Record::Map_t& records);
+
+private:
+    Poco::FileOutputStream _out;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,201 @@
+#include "listparser.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
+
+namespace
+{
+    // Line end left by getline() on CRLF listing
+    size_t trimEnd(const std::string& line, size_t begin)
+    {
+        size_t end = line.size();
+        while (end > begin && ('\r' == line[end - 1] || '\n' == line[end - 1]))
+            --end;
+        return end;
+    }
+
+    // 1..12 for English abbreviation, 0 if it is not month
+    int monthNumber(const std::string& str)
+    {
+        static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (3 != str.size()) return 0;
+        for (int i = 0; i < 12; ++i)
+            if (!strncmp(months + i * 3, str.c_str(), 3)) return i + 1;
+        return 0;
+    }
+
+    // YYYYMMDDHHMM[SS] as seconds since epoch, false if it is not such
+    bool parseTime(const char* str, size_t length, time_t& time)
+    {
+        if (12 != length && 14 != length) return false;
+        for (size_t i = 0; i < length; ++i)
+            if (!isdigit(static_cast<unsigned char>(str[i]))) return false;
+        const std::string s(str, length);
+        struct tm t;
+        memset(&t, 0, sizeof(t));
+        t.tm_year = atoi(s.substr(0, 4).c_str()) - 1900;
+        t.tm_mon = atoi(s.substr(4, 2).c_str()) - 1;
+        t.tm_mday = atoi(s.substr(6, 2).c_str());
+        t.tm_hour = atoi(s.substr(8, 2).c_str());
+        t.tm_min = atoi(s.substr(10, 2).c_str());
+        if (14 == length) t.tm_sec = atoi(s.substr(12, 2).c_str());
+        time = timegm(&t);
+        return true;
+    }
+
+    // First length characters of YYYYMMDDHHMMSS of time
+    std::string formatTime(time_t time, size_t length)
+    {
+        struct tm t;
+        gmtime_r(&time, &t);
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%04d%02d%02d%02d%02d%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+                 t.tm_hour, t.tm_min, t.tm_sec);
+        return std::string(buf, length);
+    }
+
+    // Local day of precise UTC date, empty if it is not such
+    std::string localDay(const char* str, size_t length, int offset)
+    {
+        time_t time;
+        if (8 == length) return std::string(str, length);
+        return parseTime(str, length, time) ? formatTime(time + offset, 8) : std::string();
+    }
+}
+
+bool ListParser::parseMLSD(const std::string& line, std::string& name, Facts_t& facts)
+{
+    facts.clear();
+
+    // Facts end with the first space and name may contain ';',
+    // server sending no space has name after the last ';'
+    size_t factsEnd = line.find(' ');
+    size_t nameBegin = factsEnd + 1;
+    if (std::string::npos == factsEnd) {
+        factsEnd = line.rfind(';');
+        nameBegin = std::string::npos == factsEnd ? 0 : factsEnd + 1;
+        if (std::string::npos == factsEnd) factsEnd = 0;
+    }
+    name.assign(line, nameBegin, trimEnd(line, nameBegin) - nameBegin);
+    if (name.empty() || "." == name || ".." == name) return false;
+
+    for (size_t pos = 0; pos < factsEnd; ) {
+        size_t end = line.find(';', pos);
+        if (std::string::npos == end || end > factsEnd) end = factsEnd;
+        const size_t eq = line.find('=', pos);
+        if (eq < end)
+            facts[line.substr(pos, eq - pos)] = line.substr(eq + 1, end - eq - 1);
+        pos = end + 1;
+    }
+    return true;
+}
+
+std::string ListParser::parseName(const std::string& line)
+{
+    const size_t slash = line.rfind('/');
+    const size_t begin = std::string::npos == slash ? 0 : slash + 1;
+    const size_t end = trimEnd(line, begin);
+    if ((1 == end - begin && '.' == line[begin]) ||
+            (2 == end - begin && '.' == line[begin] && '.' == line[begin + 1]))
+        return std::string();
+    return line.substr(begin, end - begin);
+}
+
+bool ListParser::parseLong(const std::string& line, int year, int month, std::string& name,
+                           bool& isDirectory, std::string& size, std::string& modify)
+{
+    if (line.size() < 10 || ('-' != line[0] && 'd' != line[0] && 'l' != line[0]))
+        return false;
+
+    // Owner or group may be missing, so fields are counted back from month:
+    // size month day time-or-year name, name is the rest of line
+    std::vector<std::string> fields;
+    size_t begin = 0, m = 0;
+    for (size_t end = 0; ; ) {
+        begin = line.find_first_not_of(' ', end);
+        if (std::string::npos == begin || fields.size() > 9) return false;
+        if (fields.size() >= 7) {
+            m = fields.size() - 3;
+            if (monthNumber(fields[m]) && isdigit(static_cast<unsigned char>(fields[m - 1][0])))
+                break;
+        }
+        end = line.find(' ', begin);
+        fields.push_back(line.substr(begin, std::string::npos == end ? end : end - begin));
+        if (std::string::npos == end) return false;
+    }
+
+    size_t end = trimEnd(line, begin);
+    isDirectory = 'd' == line[0];
+    if ('l' == line[0]) {
+        const size_t arrow = line.find(" -> ", begin);
+        if (arrow < end) end = arrow;
+    }
+    name.assign(line, begin, end - begin);
+    if (name.empty() || "." == name || ".." == name) return false;
+    size = fields[m - 1];
+
+    int entryMonth = monthNumber(fields[m]), entryYear = year, hour = 0, minute = 0;
+    const std::string& day = fields[m + 1];
+    const std::string& timeOrYear = fields[m + 2];
+    const bool hasTime = std::string::npos != timeOrYear.find(':');
+    if (!hasTime)
+        entryYear = atoi(timeOrYear.c_str());
+    else {
+        sscanf(timeOrYear.c_str(), "%d:%d", &hour, &minute);
+        if (entryMonth > month) --entryYear; // recent file of last year
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04d%02d%02d%02d%02d", entryYear, entryMonth, atoi(day.c_str()), hour, minute);
+    modify.assign(buf, hasTime ? 12 : 8);
+    return true;
+}
+
+bool ListParser::utcOffset(const std::string& local, const std::string& utc, int& offset)
+{
+    time_t l, u;
+    if (!parseTime(local.data(), std::min<size_t>(local.size(), 12), l) ||
+            !parseTime(utc.data(), std::min<size_t>(utc.size(), 12), u))
+        return false;
+    static const long Quarter = 15 * 60;
+    const long diff = long(l - u);
+    offset = int((diff + (diff < 0 ? -Quarter : Quarter) / 2) / Quarter * Quarter);
+    return offset >= -14 * 3600 && offset <= 14 * 3600;
+}
+
+void ListParser::toUtc(std::string& modify, int offset)
+{
+    time_t time;
+    if (12 == modify.size() && parseTime(modify.data(), modify.size(), time))
+        modify = formatTime(time - offset, 12);
+}
+
+bool ListParser::sameModify(const char* stored, size_t length, const std::string& listed, int offset)
+{
+    const size_t precision = std::min(length, listed.size());
+    if (12 == precision || 14 == precision) // both UTC
+        return 0 == memcmp(stored, listed.data(), precision);
+    if (8 == precision) {
+        const std::string day = localDay(stored, length, offset);
+        return !day.empty() && day == localDay(listed.data(), listed.size(), offset);
+    }
+    return length == listed.size() && 0 == memcmp(stored, listed.data(), length);
+}
+
+bool ListParser::parseSection(const std::string& line, std::string& dir)
+{
+    size_t end = trimEnd(line, 0);
+    if (!end || ':' != line[end - 1]) return false;
+    --end;
+
+    // ".", "./a/b", "a/b" and "/a/b" are all under root
+    size_t begin = 0;
+    if (begin < end && '.' == line[begin] && (begin + 1 == end || '/' == line[begin + 1])) ++begin;
+    while (begin < end && '/' == line[begin]) ++begin;
+    while (end > begin && '/' == line[end - 1]) --end;
+    dir = begin == end ? std::string() : "/" + line.substr(begin, end - begin);
+    return true;
+}
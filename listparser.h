@@ -0,0 +1,39 @@
+#ifndef LISTPARSER_H
+#define LISTPARSER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Parsers of directory listing lines, apart from ftp session to be measured alone
+class ListParser
+{
+public:
+    typedef std::map<std::string, std::string> Facts_t;
+
+    // MLSD line "fact=value;...; name", false for . and .. or line without name
+    static bool parseMLSD(const std::string& line, std::string& name, Facts_t& facts);
+    // Name of LIST line holding name only (path is cut), empty for . and ..
+    static std::string parseName(const std::string& line);
+
+    // "ls -l" style LIST line, false for "total" and other lines, . and .. Modify date
+    // is in server local time as precise as listed: YYYYMMDDHHMM of recent file, whose
+    // year is guessed from now, and YYYYMMDD of file older than half a year listed
+    // with year. Symbolic link is named without its target
+    static bool parseLong(const std::string& line, int year, int month, std::string& name,
+                          bool& isDirectory, std::string& size, std::string& modify);
+    // Seconds server local time is ahead of UTC, from the same time listed by LIST
+    // (YYYYMMDDHHMM) and by MDTM (YYYYMMDDHHMMSS), rounded to quarter of hour
+    static bool utcOffset(const std::string& local, const std::string& utc, int& offset);
+    // Date of minute precision is moved from server local time to UTC, day one is
+    // left local as its day is not known in UTC
+    static void toUtc(std::string& modify, int offset);
+    // Stored and listed modify dates are equal at precision of the less precise one.
+    // Dates of minute and second precision are UTC, day ones are server local, so
+    // precise one is moved by offset for them
+    static bool sameModify(const char* stored, size_t length, const std::string& listed, int offset = 0);
+    // Header "dir:" of section in recursive listing, dir is made "/dir", "" for root
+    static bool parseSection(const std::string& line, std::string& dir);
+};
+
+#endif // LISTPARSER_H
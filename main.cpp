@@ -1,19 +1,42 @@
 #include "data.h"
 #include "backuptask.h"
 #include "main.h"
+#include "ringchannel.h"
+#include "replicator.h"
+#include "tracer.h"
 
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <memory>
 #include <iostream>
+#include <signal.h>
+#include <Poco/Path.h>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/AutoPtr.h>
 #include <Poco/Format.h>
+#include <Poco/Thread.h>
+#include <Poco/Process.h>
+#include <Poco/Environment.h>
 #include <Poco/TaskManager.h>
+#include <Poco/ThreadPool.h>
+#include <Poco/TaskNotification.h>
+#include <Poco/Observer.h>
+#include <Poco/RunnableAdapter.h>
 #include <Poco/NumberParser.h>
 #include <Poco/DateTimeParser.h>
 #include <Poco/StringTokenizer.h>
 #include <Poco/Util/Application.h>
+#include <Poco/Util/ServerApplication.h>
+#include <Poco/Util/PropertyFileConfiguration.h>
 #include <Poco/Util/OptionSet.h>
 #include <Poco/Util/Option.h>
 #include <Poco/Util/HelpFormatter.h>
 
 using Poco::Util::Application;
+using Poco::Util::ServerApplication;
+using Poco::Util::AbstractConfiguration;
 using Poco::Util::Option;
 using Poco::Util::OptionSet;
 using Poco::Util::OptionCallback;
@@ -21,20 +44,25 @@ using Poco::Util::HelpFormatter;
 
 const std::string App::EmptyString;
 
-class Main : public Application
+class Main : public ServerApplication
 {
 public:
-    Main()
+    Main() : _terminate(false), _reload(false), _failed(false), _compact(0), _verify(0), _shardIndex(0), _shardCount(0),
+        _running(0)
     {
         // Reset all option flags;
         for (int i = 0; i < AllOptions; ++i)
             _optionRequested[i] = false;
+
+        RingChannel::registerChannel(); // before logging is configured
+        signal(SIGPIPE, SIG_IGN); // write to exited tar fails instead of killing process
     }
 
     ~Main() { }
 
 protected:
-    enum OptionName { HelpOption, VersionOption, ConfigOption, RestoreOption, AllOptions };
+    enum OptionName { HelpOption, VersionOption, ConfigOption, RestoreOption, ServiceOption,
+                      CompactOption, EstimateOption, ShardOption, VerifyOption, AllOptions };
 
     void initialize(Poco::Util::Application& self)
     {
@@ -59,7 +87,9 @@ protected:
       //  if (!HasOption(HelpOption) && !HasOption(VersionOption))
       //      logger().information("Shutting down");
 
-        Application::uninitialize();
+        // Queued messages are written before exit
+        if (logger().getChannel()) logger().getChannel()->close();
+        ServerApplication::uninitialize();
     }
 
     bool HasOption(OptionName opt) const
@@ -76,7 +106,7 @@ protected:
 
     void defineOptions(Poco::Util::OptionSet& options)
     {
-        Application::defineOptions(options);
+        ServerApplication::defineOptions(options);
 
         options.addOption(Option("help", "h", "display this help")
             .callback(OptionCallback<Main>(this, &Main::handleHelp)));
@@ -88,6 +118,25 @@ protected:
         options.addOption(Option("restore", "r ", "restores archive on site up the date")
             .argument("id_site:datetime")
             .callback(OptionCallback<Main>(this, &Main::handleRestore)));
+        options.addOption(Option("filter", "f", "restore only entries under path or matching glob, may be repeated")
+            .argument("path")
+            .repeatable(true)
+            .callback(OptionCallback<Main>(this, &Main::handleFilter)));
+        options.addOption(Option("compact", "k", "merge archives into full snapshot and remove superseded, all sites if no id given")
+            .argument("id_site", false)
+            .callback(OptionCallback<Main>(this, &Main::handleCompact)));
+        options.addOption(Option("verify", "t", "read archives and check checksums of files, all sites if no id given")
+            .argument("id_site", false)
+            .callback(OptionCallback<Main>(this, &Main::handleVerify)));
+        options.addOption(Option("service", "s", "run scheduled backups until terminated, SIGHUP reloads configuration")
+            .callback(OptionCallback<Main>(this, &Main::handleService)));
+        options.addOption(Option("estimate", "e", "list sites and report changes and bytes to download, nothing is stored")
+            .callback(OptionCallback<Main>(this, &Main::handleEstimate)));
+        options.addOption(Option("dry-run", "", "same as --estimate")
+            .callback(OptionCallback<Main>(this, &Main::handleEstimate)));
+        options.addOption(Option("shard", "", "back up only sites with id % n = k - 1")
+            .argument("k/n")
+            .callback(OptionCallback<Main>(this, &Main::handleShard)));
         options.addOption(Option("batch", "b ", "execute serial commands on ftp server, reserved words are: #quit, #continue")
             .argument("cmd1[:arg][,cmd2[:arg]]")
             .callback(OptionCallback<Main>(this, &Main::handleBatch)));
@@ -124,9 +173,74 @@ protected:
         (void)name;
         _optionRequested[ConfigOption] = true;
 
+        _configPath = value;
         loadConfiguration(value);
     }
 
+    void handleCompact(const std::string& name, const std::string& value)
+    {
+        try {
+            _compact = value.empty() ? 0 : Poco::NumberParser::parseUnsigned(value);
+            _optionRequested[CompactOption] = true;
+        } catch (Poco::Exception& ex) {
+            std::cout << "Can't recognize compact parameter \"" << value << "\"";
+            std::cout << std::endl << ex.displayText() << std::endl << std::endl;
+            handleHelp(name, value);
+        }
+    }
+
+    void handleVerify(const std::string& name, const std::string& value)
+    {
+        try {
+            _verify = value.empty() ? 0 : Poco::NumberParser::parseUnsigned(value);
+            _optionRequested[VerifyOption] = true;
+        } catch (Poco::Exception& ex) {
+            std::cout << "Can't recognize verify parameter \"" << value << "\"";
+            std::cout << std::endl << ex.displayText() << std::endl << std::endl;
+            handleHelp(name, value);
+        }
+    }
+
+    void handleService(const std::string& name, const std::string& value)
+    {
+        (void)name;
+        (void)value;
+        _optionRequested[ServiceOption] = true;
+    }
+
+    void handleEstimate(const std::string& name, const std::string& value)
+    {
+        (void)name;
+        (void)value;
+        _optionRequested[EstimateOption] = true;
+    }
+
+    void handleShard(const std::string& name, const std::string& value)
+    {
+        try {
+            Poco::StringTokenizer tok(value, "/", Poco::StringTokenizer::TOK_TRIM);
+            if (2 != tok.count())
+                throw Poco::ApplicationException("Expected k/n");
+            _shardIndex = Poco::NumberParser::parseUnsigned(tok[0]);
+            _shardCount = Poco::NumberParser::parseUnsigned(tok[1]);
+            if (!_shardIndex || _shardIndex > _shardCount)
+                throw Poco::ApplicationException("Shard number must be from 1 to n");
+            --_shardIndex;
+            _optionRequested[ShardOption] = true;
+        } catch (Poco::Exception& ex) {
+            _shardCount = 0;
+            std::cout << "Can't recognize shard parameter \"" << value << "\"";
+            std::cout << std::endl << ex.displayText() << std::endl << std::endl;
+            handleHelp(name, value);
+        }
+    }
+
+    void handleFilter(const std::string& name, const std::string& value)
+    {
+        (void)name;
+        _restoreFilter.push_back(value);
+    }
+
     void handleRestore(const std::string& name, const std::string& value)
     {
         try {
@@ -162,27 +276,466 @@ protected:
         (void)args;
         if (HasOption(HelpOption) || HasOption(VersionOption))
             return EXIT_OK;
+        // Both work with <tp> archives, mirror directories have none
+        if (BackupTask::mirrorMode() && (HasOption(VerifyOption) || Replicator::enabled())) {
+            logger().error("Verification and replication (--verify, replica.remote) "
+                "are not supported with storage.mode = mirror");
+            return EXIT_CONFIG;
+        }
+        if (HasOption(ServiceOption) && !HasOption(RestoreOption) && !HasOption(CompactOption) &&
+                !HasOption(EstimateOption) && !HasOption(VerifyOption))
+            return runService();
 
         Data data;
         if (HasOption(RestoreOption)) {
             Data::Site::Ptr_t site = data.siteById(_restore.first);
             if (!site) throw Poco::NotFoundException(Poco::format("Unable to find site with id %u", _restore.first));
-            BackupTask::restore(site, _restore.second);
-        } else {
             Poco::TaskManager tm;
-            // Start observer thread
+            tm.addObserver(Poco::Observer<Main, Poco::TaskProgressNotification>(*this, &Main::onProgress));
+            tm.addObserver(Poco::Observer<Main, Poco::TaskFailedNotification>(*this, &Main::onFailed));
+            tm.start(new RestoreTask(site, _restore.second, _restoreFilter));
+            tm.joinAll();
+            if (_failed) return EXIT_SOFTWARE;
+        } else if (HasOption(CompactOption)) {
+            Replicator::start();
+            for (size_t i = 0, count = data.sites().size(); i < count; ++i) {
+                Data::Site::Ptr_t site = data.sites()[i];
+                if ((_compact && _compact != site->id) || !inShard(site->id)) continue;
+                try { BackupTask::compact(site); }
+                catch (Poco::Exception& ex) { logger().log(ex); }
+            }
+            Replicator::stop();
+        } else if (HasOption(VerifyOption)) {
+            for (size_t i = 0, count = data.sites().size(); i < count; ++i) {
+                Data::Site::Ptr_t site = data.sites()[i];
+                if ((_verify && _verify != site->id) || !inShard(site->id)) continue;
+                try { BackupTask::verify(site); }
+                catch (Poco::Exception& ex) { logger().log(ex); }
+            }
+        } else if (HasOption(EstimateOption)) {
+            runEstimate(data);
+        } else {
+            // Sites wait in queue for one of backup.threads workers, archives are uploaded meanwhile
+            Replicator::start();
+            Tracer::start();
+            const int threads = backupThreads();
+            Poco::ThreadPool pool(1, spareThreads(threads));
+            Poco::TaskManager tm(pool);
+            tm.addObserver(Poco::Observer<Main, Poco::TaskFinishedNotification>(*this, &Main::onFinished));
+            std::deque<Data::Site::Ptr_t> queue;
             for (size_t i = 0, count = data.sites().size(); i < count; ++i)
-                try { tm.start(new BackupTask(data.sites()[i], _batch)); }
-                catch (...) { }
+                if (inShard(data.sites()[i]->id)) queue.push_back(data.sites()[i]);
+            while (!queue.empty()) {
+                Poco::Timestamp::TimeVal due = 0; // woken up by finished task
+                if (running() < threads) {
+                    // Other instance holds the site or has backed it up recently
+                    if (!claimSite(queue.front(), config().getInt("lease.skipRecent", 3600))) {
+                        queue.pop_front();
+                        continue;
+                    }
+                    try {
+                        tm.start(new BackupTask(queue.front(), _batch));
+                        started();
+                        queue.pop_front();
+                        continue;
+                    }
+                    catch (Poco::NoThreadAvailableException&) { due = retryTime(); }
+                }
+                waitWakeUp(due);
+                renewLeases(tm);
+            }
+            while (running()) {
+                waitWakeUp(0);
+                renewLeases(tm);
+            }
             tm.joinAll();
+            Tracer::stop();
+            Replicator::stop();
         }
         return EXIT_OK;
     }
 
+    // Listing only, sites wait in queue for one of estimate.threads workers.
+    // Report is printed to stdout, the log gets it too
+    void runEstimate(const Data& data)
+    {
+        const Data::Site::List_t& sites = data.sites();
+        const int threads = estimateThreads();
+        Poco::ThreadPool pool(1, spareThreads(threads));
+        Poco::TaskManager tm(pool);
+        tm.addObserver(Poco::Observer<Main, Poco::TaskFinishedNotification>(*this, &Main::onEstimated));
+        std::vector<Poco::AutoPtr<BackupTask> > tasks;
+        for (size_t i = 0, count = sites.size(); i < count; ) {
+            Poco::Timestamp::TimeVal due = 0;
+            if (running() < threads) {
+                Poco::AutoPtr<BackupTask> task(new BackupTask(sites[i], StrListPtr_t(), true));
+                try {
+                    task->duplicate(); // reference owned by task manager
+                    tm.start(task);
+                    started();
+                    tasks.push_back(task);
+                    ++i;
+                    continue;
+                }
+                catch (Poco::NoThreadAvailableException&) { due = retryTime(); } // manager dropped its reference
+            }
+            waitWakeUp(due);
+        }
+        tm.joinAll();
+
+        BackupTask::Estimate total = { 0, 0, 0, 0 };
+        size_t failed = 0;
+        for (size_t i = 0, count = tasks.size(); i < count; ++i) {
+            if (!tasks[i]->succeeded()) {
+                ++failed;
+                std::cout << "Site " << tasks[i]->site()->id << ": failed, see log" << std::endl;
+                continue;
+            }
+            const BackupTask::Estimate& est = tasks[i]->estimate();
+            std::cout << Poco::format("Site %u: %z new, %z modified, %z deleted, %s to download",
+                tasks[i]->site()->id, est.added, est.modified, est.deleted, BackupTask::formatBytes(est.bytes))
+                << std::endl;
+            total.added += est.added;
+            total.modified += est.modified;
+            total.deleted += est.deleted;
+            total.bytes += est.bytes;
+        }
+        const std::string report = Poco::format("Estimate for %z sites: %z new, %z modified, %z deleted, "
+            "%s to download", sites.size() - failed, total.added, total.modified, total.deleted,
+            BackupTask::formatBytes(total.bytes)) + (failed ? Poco::format(", %z sites failed", failed) : "");
+        std::cout << report << std::endl;
+        logger().information(report);
+    }
+
+    void onEstimated(Poco::TaskFinishedNotification* nf)
+    {
+        finished(); // worker is free for queued site
+        nf->release();
+    }
+
+    void onProgress(Poco::TaskProgressNotification* nf)
+    {
+        logger().information(Poco::format("%s: %.0f%%", nf->task()->name(), double(nf->progress() * 100)));
+        nf->release();
+    }
+
+    void onFinished(Poco::TaskFinishedNotification* nf)
+    {
+        BackupTask* task = dynamic_cast<BackupTask*>(nf->task());
+        if (task && leasesEnabled()) {
+            try {
+                if (task->succeeded())
+                    task->site()->finishLease(leaseOwner());
+                else // other instance may retry at once
+                    task->site()->releaseLease(leaseOwner());
+            }
+            catch (Poco::Exception& ex) { logger().log(ex); } // expires by itself
+        }
+        finished(); // worker is free for queued site
+        nf->release();
+    }
+
+    bool inShard(unsigned siteId) const
+    {
+        return !_shardCount || _shardIndex == siteId % _shardCount;
+    }
+
+    bool leasesEnabled()
+    {
+        return config().getBool("lease.enabled", false);
+    }
+
+    // Identity of this instance in lease rows
+    std::string leaseOwner()
+    {
+        if (_leaseOwner.empty())
+            _leaseOwner = config().getString("lease.owner",
+                Poco::format("%s:%d", Poco::Environment::nodeName(), int(Poco::Process::id())));
+        return _leaseOwner;
+    }
+
+    int leaseTtl()
+    {
+        return std::max(30, config().getInt("lease.ttl", 600));
+    }
+
+    // Site is taken if leases are off or lease is claimed, age is seconds since
+    // the last finished run of any instance under which site is not taken again
+    bool claimSite(Data::Site::Ptr_t site, int age)
+    {
+        if (!leasesEnabled()) return true;
+        try {
+            if (site->claimLease(leaseOwner(), leaseTtl(), age)) return true;
+            logger().information(Poco::format("Site %u is leased by other instance or finished recently", site->id));
+        }
+        catch (Poco::Exception& ex) { logger().log(ex); }
+        return false;
+    }
+
+    // Leases of running sites are renewed three times per ttl
+    void renewLeases(Poco::TaskManager& tm)
+    {
+        if (!leasesEnabled()) return;
+        const Poco::Timestamp now;
+        if (now - _leaseRenewed < Poco::Timestamp::TimeDiff(leaseTtl()) * Poco::Timestamp::resolution() / 3)
+            return;
+        _leaseRenewed = now;
+
+        Poco::TaskManager::TaskList tasks = tm.taskList();
+        for (Poco::TaskManager::TaskList::iterator it = tasks.begin(), end = tasks.end(); it != end; ++it) {
+            BackupTask* task = dynamic_cast<BackupTask*>(it->get());
+            if (!task || Poco::Task::TASK_FINISHED == task->state()) continue;
+            try {
+                if (!task->site()->renewLease(leaseOwner(), leaseTtl())) {
+                    // Other instance may back it up already, run stops and is recovered later
+                    logger().warning(Poco::format("Site %u lease is lost, cancelling backup", task->site()->id));
+                    task->cancel();
+                }
+            }
+            catch (Poco::Exception& ex) { logger().log(ex); }
+        }
+    }
+
+    void onFailed(Poco::TaskFailedNotification* nf)
+    {
+        logger().log(nf->reason());
+        _failed = true;
+        nf->release();
+    }
+
+    int runService()
+    {
+        // Only waiter thread receives signals, so block them before any thread starts
+        sigset_t sset;
+        serviceSignals(sset);
+        pthread_sigmask(SIG_BLOCK, &sset, 0);
+
+        Poco::Thread waiter;
+        Poco::RunnableAdapter<Main> ra(*this, &Main::waitSignals);
+        waiter.start(ra);
+
+        logger().information("Service started");
+        // Database session, prepared statements and ftp sessions stay opened between runs
+        BackupTask::keepConnections(true);
+        std::auto_ptr<Data> data(new Data);
+        Replicator::start();
+        Tracer::start();
+
+        typedef std::map<unsigned, Poco::AutoPtr<BackupTask> > Tasks_t;
+        Tasks_t tasks; // last started task by site id
+        std::map<unsigned, Poco::Timestamp::TimeVal> schedule; // next run by site id
+        const int threads = backupThreads(); // pool is not resized by reload
+        Poco::ThreadPool pool(1, spareThreads(threads));
+        Poco::TaskManager tm(pool);
+        tm.addObserver(Poco::Observer<Main, Poco::TaskFinishedNotification>(*this, &Main::onFinished));
+
+        bool busy = false; // trace file is written when all backups finish
+        while (!_terminate) {
+            Poco::Timestamp::TimeVal due = 0; // the earliest next run, 0 when none is pending
+            if (_reload) {
+                logger().information("Reloading configuration");
+                tm.joinAll(); // running backups finish with old settings
+                tasks.clear();
+                BackupTask::keepConnections(false);
+                Tracer::stop();
+                Replicator::stop();
+                data.reset(); // release singleton before new one is created
+                reloadConfiguration();
+                data.reset(new Data);
+                BackupTask::keepConnections(true);
+                Replicator::start();
+                Tracer::start();
+                _reload = false;
+            }
+
+            const Poco::Timestamp now;
+            for (size_t i = 0, count = data->sites().size(); i < count; ++i) {
+                Data::Site::Ptr_t site = data->sites()[i];
+                if (!inShard(site->id)) continue;
+                Tasks_t::iterator it = tasks.find(site->id);
+                if (tasks.end() != it) {
+                    if (Poco::Task::TASK_FINISHED != it->second->state())
+                        continue; // previous run is still active
+                    tasks.erase(it); // return ftp session to the pool
+                }
+
+                Poco::Timestamp::TimeVal& next = schedule[site->id];
+                if (next > now.epochMicroseconds()) {
+                    due = due ? std::min(due, next) : next;
+                    continue;
+                }
+                if (running() >= threads) break; // due sites wait for free worker
+                // Run of other instance in the last half of interval counts as ours
+                if (!claimSite(site, scheduleInterval(site->id) / 2)) {
+                    next = now.epochMicroseconds() + leaseTtl() * Poco::Timestamp::resolution();
+                    due = due ? std::min(due, next) : next;
+                    continue;
+                }
+                next = now.epochMicroseconds() + scheduleInterval(site->id) * Poco::Timestamp::resolution();
+                due = due ? std::min(due, next) : next;
+
+                site->timePoint = now.epochMicroseconds();
+                try {
+                    Poco::AutoPtr<BackupTask> task(new BackupTask(site, _batch));
+                    task->duplicate(); // reference owned by task manager
+                    tm.start(task);
+                    started();
+                    tasks[site->id] = task;
+                }
+                catch (Poco::NoThreadAvailableException&) { next = 0; due = retryTime(); }
+                catch (Poco::Exception& ex) { logger().log(ex); }
+                catch (...) { }
+            }
+            waitWakeUp(due);
+            renewLeases(tm);
+            if (busy && !running()) Tracer::flush();
+            busy = running() > 0;
+        }
+
+        logger().information("Service stopping, waiting for running backups");
+        tm.joinAll();
+        tasks.clear();
+        BackupTask::keepConnections(false);
+        Tracer::stop();
+        Replicator::stop();
+        waiter.join();
+        return EXIT_OK;
+    }
+
+    // Count of sites backed up at the same time
+    int backupThreads()
+    {
+        return std::max(1, config().getInt("backup.threads", 8));
+    }
+
+    // Count of sites listed at the same time on estimate, nothing is downloaded
+    // so it is not limited by backup.threads
+    int estimateThreads()
+    {
+        return std::max(1, config().getInt("estimate.threads", 32));
+    }
+
+    // Worker of finished task returns to the pool after its finished notification,
+    // so pool has spare threads and next site starts at once
+    static int spareThreads(int threads)
+    {
+        return 2 * threads;
+    }
+
+    // Pool is still full in rare case, start is retried shortly
+    static Poco::Timestamp::TimeVal retryTime()
+    {
+        return Poco::Timestamp().epochMicroseconds() + 10 * 1000;
+    }
+
+    // TaskManager posts finished notification before it drops the task, so its
+    // count() is stale there; tasks are counted here instead
+    void started()
+    {
+        Poco::FastMutex::ScopedLock lock(_runningMutex);
+        ++_running;
+    }
+
+    void finished()
+    {
+        {
+            Poco::FastMutex::ScopedLock lock(_runningMutex);
+            --_running;
+        }
+        _wakeUp.set();
+    }
+
+    int running()
+    {
+        Poco::FastMutex::ScopedLock lock(_runningMutex);
+        return _running;
+    }
+
+    // Wait for finished task or signal, but not past due time (0 is none), the
+    // next lease renewal and a minute, so a lost wake up only delays the loop
+    void waitWakeUp(Poco::Timestamp::TimeVal due)
+    {
+        const Poco::Timestamp::TimeVal now = Poco::Timestamp().epochMicroseconds();
+        const Poco::Timestamp::TimeVal limit = now + 60 * Poco::Timestamp::resolution();
+        due = due ? std::min(due, limit) : limit;
+        if (leasesEnabled())
+            due = std::min(due, _leaseRenewed.epochMicroseconds() +
+                Poco::Timestamp::TimeVal(leaseTtl()) * Poco::Timestamp::resolution() / 3);
+        if (due > now)
+            _wakeUp.tryWait(static_cast<long>((due - now) / 1000 + 1));
+    }
+
+    // Seconds between two runs of the site
+    long scheduleInterval(unsigned siteId)
+    {
+        const int def = config().getInt("schedule.interval", 86400);
+        return config().getInt(Poco::format("schedule.site.%u", siteId), def);
+    }
+
+    static void serviceSignals(sigset_t& sset)
+    {
+        sigemptyset(&sset);
+        sigaddset(&sset, SIGINT);
+        sigaddset(&sset, SIGQUIT);
+        sigaddset(&sset, SIGTERM);
+        sigaddset(&sset, SIGHUP);
+    }
+
+    void waitSignals()
+    {
+        sigset_t sset;
+        serviceSignals(sset);
+        for (int sig = 0; !_terminate; ) {
+            if (0 != sigwait(&sset, &sig)) continue;
+            if (SIGHUP == sig)
+                _reload = true;
+            else
+                _terminate = true;
+            _wakeUp.set();
+        }
+    }
+
+    void reloadConfiguration()
+    {
+        Poco::Path path(_configPath);
+        if (_configPath.empty()) { // same file as found by loadConfiguration()
+            path = config().getString("application.path");
+            path.setExtension("properties");
+        }
+
+        Poco::AutoPtr<Poco::Util::PropertyFileConfiguration> conf(
+            new Poco::Util::PropertyFileConfiguration(path.toString()));
+        copyConfiguration(*conf, "");
+    }
+
+    // Copy properties over the loaded ones
+    void copyConfiguration(const AbstractConfiguration& src, const std::string& key)
+    {
+        if (!key.empty() && src.hasProperty(key))
+            config().setString(key, src.getString(key));
+
+        AbstractConfiguration::Keys keys;
+        src.keys(key, keys);
+        for (size_t i = 0, count = keys.size(); i < count; ++i)
+            copyConfiguration(src, key.empty() ? keys[i] : key + "." + keys[i]);
+    }
+
 private:
     bool _optionRequested[AllOptions];
+    std::string _configPath;
+    volatile bool _terminate, _reload;
+    bool _failed; // task reported failure
+    Poco::Event _wakeUp;
+    Poco::FastMutex _runningMutex;
+    int _running; // started tasks without finished notification
     std::pair<unsigned, Poco::DateTime> _restore;
+    StrList_t _restoreFilter; // paths and globs of partial restore
+    unsigned _compact; // site id to compact, 0 for all
+    unsigned _verify; // site id to verify, 0 for all
+    unsigned _shardIndex, _shardCount; // --shard k/n as k - 1 and n, n is 0 if not given
+    std::string _leaseOwner;
+    Poco::Timestamp _leaseRenewed;
     StrListPtr_t _batch;
 };
 
-POCO_APP_MAIN(Main)
+POCO_SERVER_MAIN(Main)
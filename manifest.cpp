@@ -0,0 +1,196 @@
+#include "manifest.h"
+#include "listparser.h"
+
+#include <cstring>
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/Exception.h>
+#include <Poco/FileStream.h>
+
+using Poco::UInt32;
+
+namespace
+{
+    const char Magic[4] = { 'F', 'B', 'M', '2' };
+
+    int compare(const char* name, size_t length, const std::string& str)
+    {
+        const int ret = memcmp(name, str.data(), std::min(length, str.size()));
+        if (ret) return ret;
+        return length < str.size() ? -1 : (length > str.size() ? 1 : 0);
+    }
+}
+
+// Local cache only, so native byte order and alignment are used
+struct Manifest::Header
+{
+    char magic[4];
+    UInt32 count; // of entries
+    Poco::Int64 generationCount;
+    Data::TimePoint_t generationTimePoint;
+    UInt32 poolSize; // of names, modify dates and unique facts following entries
+    UInt32 reserved;
+};
+
+struct Manifest::Entry
+{
+    UInt32 id, crc32, isDirectory;
+    UInt32 nameOffset, nameLength, modifyOffset, modifyLength;
+    UInt32 uniqueLength; // follows modify date
+};
+
+Manifest::Manifest() : _entries(0), _pool(0), _size(0)
+{
+}
+
+bool Manifest::open(const std::string& path, const Data::Generation& generation)
+{
+    _memory = Poco::SharedMemory();
+    _entries = 0;
+    _pool = 0;
+    _size = 0;
+
+    Poco::File file(path);
+    if (!file.exists() || file.getSize() < sizeof(Header)) return false;
+
+    Poco::SharedMemory memory(file, Poco::SharedMemory::AM_READ);
+    const size_t length = memory.end() - memory.begin();
+    const Header* header = reinterpret_cast<const Header*>(memory.begin());
+    if (memcmp(header->magic, Magic, sizeof(Magic)) ||
+            length != sizeof(Header) + header->count * sizeof(Entry) + header->poolSize)
+        return false; // damaged or of other format
+    if (header->generationCount != generation.count || header->generationTimePoint != generation.timePoint)
+        return false;
+
+    _memory = memory;
+    _entries = reinterpret_cast<const Entry*>(memory.begin() + sizeof(Header));
+    _pool = memory.begin() + sizeof(Header) + header->count * sizeof(Entry);
+    _size = header->count;
+    return true;
+}
+
+void Manifest::write(const std::string& path, const Data::Generation& generation, Record::List_t& records)
+{
+    std::sort(records.begin(), records.end());
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.count = static_cast<UInt32>(records.size());
+    header.generationCount = generation.count;
+    header.generationTimePoint = generation.timePoint;
+
+    std::vector<Entry> entries(records.size());
+    for (size_t i = 0, count = records.size(); i < count; ++i) {
+        const Record& rec = records[i];
+        Entry& e = entries[i];
+        e.id = rec.id;
+        e.crc32 = rec.crc32;
+        e.isDirectory = rec.isDirectory;
+        e.nameOffset = header.poolSize;
+        e.nameLength = static_cast<UInt32>(rec.fullName.size());
+        e.modifyOffset = e.nameOffset + e.nameLength;
+        e.modifyLength = static_cast<UInt32>(rec.modifyDate.size());
+        e.uniqueLength = static_cast<UInt32>(rec.unique.size());
+        header.poolSize = e.modifyOffset + e.modifyLength + e.uniqueLength;
+    }
+
+    // Readers of old file keep their mapping, new one is renamed over it
+    const std::string tmp = path + ".tmp";
+    {
+        Poco::FileOutputStream out(tmp, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!entries.empty())
+            out.write(reinterpret_cast<const char*>(&entries[0]), entries.size() * sizeof(Entry));
+        for (size_t i = 0, count = records.size(); i < count; ++i)
+            out << records[i].fullName << records[i].modifyDate << records[i].unique;
+        out.close();
+        if (!out.good())
+            throw Poco::WriteFileException("Unable to write manifest " + tmp);
+    }
+    Poco::File(tmp).renameTo(path);
+}
+
+void Manifest::toRecords(const Data::File::List_t& files, Record::List_t& records)
+{
+    records.resize(files.size());
+    for (size_t i = 0, count = files.size(); i < count; ++i) {
+        const Data::File& file = *files[i];
+        Record& rec = records[i];
+        rec.id = file.id;
+        rec.crc32 = file.crc32;
+        rec.isDirectory = file.isDirectory;
+        rec.fullName = file.fullName;
+        rec.modifyDate = file.modifyDate;
+        rec.unique = file.unique;
+    }
+}
+
+size_t Manifest::find(const std::string& fullName) const
+{
+    size_t lo = 0, hi = _size;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const Entry& e = _entries[mid];
+        const int cmp = compare(_pool + e.nameOffset, e.nameLength, fullName);
+        if (!cmp) return mid;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return npos;
+}
+
+const Manifest::Entry& Manifest::entry(size_t i) const
+{
+    if (i >= _size) throw Poco::RangeException("Manifest entry out of range");
+    return _entries[i];
+}
+
+unsigned Manifest::id(size_t i) const
+{
+    return entry(i).id;
+}
+
+unsigned Manifest::crc32(size_t i) const
+{
+    return entry(i).crc32;
+}
+
+bool Manifest::isDirectory(size_t i) const
+{
+    return 0 != entry(i).isDirectory;
+}
+
+std::string Manifest::fullName(size_t i) const
+{
+    const Entry& e = entry(i);
+    return std::string(_pool + e.nameOffset, e.nameLength);
+}
+
+std::string Manifest::modifyDate(size_t i) const
+{
+    const Entry& e = entry(i);
+    return std::string(_pool + e.modifyOffset, e.modifyLength);
+}
+
+std::string Manifest::unique(size_t i) const
+{
+    const Entry& e = entry(i);
+    return std::string(_pool + e.modifyOffset + e.modifyLength, e.uniqueLength);
+}
+
+bool Manifest::sameModifyDate(size_t i, const std::string& modifyDate, int offset) const
+{
+    const Entry& e = entry(i);
+    return ListParser::sameModify(_pool + e.modifyOffset, e.modifyLength, modifyDate, offset);
+}
+
+void Manifest::toRecord(size_t i, Record& record) const
+{
+    record.id = id(i);
+    record.crc32 = crc32(i);
+    record.isDirectory = isDirectory(i);
+    record.fullName = fullName(i);
+    record.modifyDate = modifyDate(i);
+    record.unique = unique(i);
+}
@@ -0,0 +1,65 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "data.h"
+#include <string>
+#include <vector>
+#include <Poco/Types.h>
+#include <Poco/SharedMemory.h>
+
+// Last committed state of site (trunk files) kept on backup host as memory mapped file
+// sorted by name, valid while its generation matches the database one
+class Manifest
+{
+    struct Header;
+    struct Entry;
+
+public:
+    struct Record
+    {
+        typedef std::vector<Record> List_t;
+
+        unsigned id, crc32;
+        bool isDirectory;
+        std::string fullName, modifyDate;
+        std::string unique; // MLSD fact of the last listing, empty if unknown
+
+        bool operator<(const Record& other) const { return fullName < other.fullName; }
+    };
+
+    static const size_t npos = size_t(-1);
+
+    Manifest();
+
+    // False if file is missing, damaged or of other generation
+    bool open(const std::string& path, const Data::Generation& generation);
+    // Records are sorted here, file is replaced atomically
+    static void write(const std::string& path, const Data::Generation& generation, Record::List_t& records);
+    static void toRecords(const Data::File::List_t& files, Record::List_t& records);
+
+    size_t size() const { return _size; }
+    // Index of entry by full name, npos if not found
+    size_t find(const std::string& fullName) const;
+
+    unsigned id(size_t i) const;
+    unsigned crc32(size_t i) const;
+    bool isDirectory(size_t i) const;
+    std::string fullName(size_t i) const;
+    std::string modifyDate(size_t i) const;
+    std::string unique(size_t i) const;
+    // Equal at precision of the less precise date, offset is of LIST local time (ListParser::sameModify)
+    bool sameModifyDate(size_t i, const std::string& modifyDate, int offset = 0) const;
+
+    void toRecord(size_t i, Record& record) const;
+
+private:
+    const Entry& entry(size_t i) const;
+
+private:
+    Poco::SharedMemory _memory;
+    const Entry* _entries;
+    const char* _pool;
+    size_t _size;
+};
+
+#endif // MANIFEST_H
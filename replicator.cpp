@@ -0,0 +1,153 @@
+#include "replicator.h"
+#include "backuptask.h"
+#include "main.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <Poco/Format.h>
+#include <Poco/Exception.h>
+
+Poco::FastMutex Replicator::_instanceMutex;
+Replicator* Replicator::_instance = 0;
+
+Replicator::Replicator() : _stop(false)
+{
+}
+
+bool Replicator::enabled()
+{
+    return !App::config("replica.remote").empty();
+}
+
+void Replicator::start()
+{
+    Poco::FastMutex::ScopedLock lock(_instanceMutex);
+    if (_instance || !enabled()) return;
+    if (BackupTask::mirrorMode()) { // configuration reloaded by service
+        App::logger().error("Replication is not supported with storage.mode = mirror, it is not started");
+        return;
+    }
+
+    // Archives of runs which ended before upload are found by listing both sides
+    _instance = new Replicator;
+    Job sync = { BackupTask::backupDir(), true };
+    _instance->_jobs.push_back(sync);
+
+    for (int i = 0, count = std::max(1, App::get().config().getInt("replica.threads", 2)); i < count; ++i) {
+        _instance->_workers.push_back(new Poco::Thread);
+        _instance->_workers.back()->start(*_instance);
+    }
+    App::logger().information("Replication to " + App::config("replica.remote") + " started");
+}
+
+void Replicator::push(const std::string& path)
+{
+    Poco::FastMutex::ScopedLock lock(_instanceMutex);
+    if (!_instance) return;
+
+    Job job = { path, false };
+    Poco::FastMutex::ScopedLock jobsLock(_instance->_mutex);
+    _instance->_jobs.push_back(job);
+    _instance->_ready.set();
+}
+
+void Replicator::stop()
+{
+    Poco::FastMutex::ScopedLock lock(_instanceMutex);
+    if (!_instance) return;
+
+    {
+        Poco::FastMutex::ScopedLock jobsLock(_instance->_mutex);
+        if (!_instance->_jobs.empty())
+            App::logger().information(Poco::format("Waiting for %z archive uploads", _instance->_jobs.size()));
+        _instance->_stop = true;
+    }
+    _instance->_ready.set(); // stopped worker wakes up the next one
+    for (size_t i = 0, count = _instance->_workers.size(); i < count; ++i)
+        _instance->_workers[i]->join();
+    delete _instance;
+    _instance = 0;
+}
+
+bool Replicator::fetch(const std::string& base)
+{
+    if (!enabled()) return false;
+
+    // Only archive of this name, <tp> does not match <tp>.full
+    const size_t slash = base.rfind('/');
+    if (std::string::npos == slash)
+        throw Poco::InvalidArgumentException("Archive path is not absolute " + base);
+    const std::string dir = base.substr(0, slash);
+    App::logger().information("Downloading archive " + base + " from " + App::config("replica.remote"));
+    int result = rclone(Poco::format("copy \"%s\" \"%s\" --include \"/%s.tar*\" %s",
+        remotePath(dir), dir, base.substr(slash + 1), options()));
+    if (result)
+        throw Poco::ApplicationException("rclone failed to download " + base, result);
+    return true;
+}
+
+void Replicator::run()
+{
+    for (Job job; pop(job); ) {
+        try { upload(job); }
+        catch (Poco::Exception& ex) { App::logger().log(ex); }
+    }
+}
+
+bool Replicator::pop(Job& job)
+{
+    for (;;) {
+        {
+            Poco::FastMutex::ScopedLock lock(_mutex);
+            if (!_jobs.empty()) {
+                job = _jobs.front();
+                _jobs.pop_front();
+                if (!_jobs.empty()) _ready.set(); // next one for other worker
+                return true;
+            }
+            if (_stop) {
+                _ready.set();
+                return false;
+            }
+        }
+        _ready.wait();
+    }
+}
+
+void Replicator::upload(const Job& job)
+{
+    int result;
+    if (job.sync) {
+        // Archives written after start are pushed by their runs, partial ones are not taken
+        const long age = long(_started.elapsed() / Poco::Timestamp::resolution()) + 1;
+        result = rclone(Poco::format("copy \"%s\" \"%s\" --filter \"- *.part.*\" --filter \"+ /*/*.tar*\""
+            " --filter \"- **\" --min-age %lds %s", job.path, remotePath(job.path), age, options()));
+    } else
+        result = rclone(Poco::format("copyto \"%s\" \"%s\" %s", job.path, remotePath(job.path), options()));
+
+    if (result)
+        throw Poco::ApplicationException("rclone failed to upload " + job.path, result);
+    if (!job.sync) App::logger().information("Archive " + job.path + " replicated");
+}
+
+std::string Replicator::options()
+{
+    const int streams = std::max(1, App::get().config().getInt("replica.streams", 4));
+    return Poco::format("--checksum --s3-upload-concurrency %d --s3-chunk-size %dM --multi-thread-streams %d",
+        streams, std::max(5, App::get().config().getInt("replica.chunkSize", 16)), streams);
+}
+
+std::string Replicator::remotePath(const std::string& path)
+{
+    // Same layout as under backup.path
+    std::string root = BackupTask::backupDir();
+    if (!root.empty() && '/' == *root.rbegin()) root.resize(root.size() - 1);
+    if (path != root && 0 != path.compare(0, root.size() + 1, root + "/"))
+        throw Poco::InvalidArgumentException("Path is not under backup.path " + path);
+    return App::config("replica.remote") + path.substr(root.size());
+}
+
+int Replicator::rclone(const std::string& args)
+{
+    return system(("rclone " + args).c_str());
+}
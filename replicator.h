@@ -0,0 +1,63 @@
+#ifndef REPLICATOR_H
+#define REPLICATOR_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/Thread.h>
+#include <Poco/SharedPtr.h>
+#include <Poco/Runnable.h>
+#include <Poco/Timestamp.h>
+
+// Copy of archives in object store (S3 compatible, through rclone remote
+// replica.remote). Finished archives are uploaded by replica.threads
+// background threads, so next backup does not wait for them; archive
+// missing on this host is downloaded back on restore. Disabled if
+// replica.remote is empty.
+class Replicator : public Poco::Runnable
+{
+public:
+    static bool enabled();
+
+    // Start workers, archives older than now missing in store are uploaded first
+    static void start();
+    // Queue upload of archive given by full path, ignored if not started
+    static void push(const std::string& path);
+    // Finish queued uploads and stop workers
+    static void stop();
+
+    // Download archive given by path without codec extension, false if it is not stored
+    static bool fetch(const std::string& base);
+
+private:
+    struct Job
+    {
+        std::string path; // archive or whole backup.path for sync
+        bool sync;
+    };
+
+    Replicator();
+    void run();
+    bool pop(Job& job);
+    void upload(const Job& job);
+
+    // Parallel parts of one archive both ways, content checked by checksum
+    static std::string options();
+    static std::string remotePath(const std::string& path);
+    static int rclone(const std::string& args);
+
+private:
+    std::deque<Job> _jobs;
+    bool _stop;
+    Poco::Timestamp _started;
+    Poco::FastMutex _mutex;
+    Poco::Event _ready;
+    std::vector<Poco::SharedPtr<Poco::Thread> > _workers;
+
+    static Poco::FastMutex _instanceMutex;
+    static Replicator* _instance;
+};
+
+#endif // REPLICATOR_H
@@ -0,0 +1,124 @@
+#include "ringchannel.h"
+
+#include <algorithm>
+#include <Poco/Format.h>
+#include <Poco/Exception.h>
+#include <Poco/NumberParser.h>
+#include <Poco/Instantiator.h>
+#include <Poco/LoggingFactory.h>
+#include <Poco/LoggingRegistry.h>
+
+RingChannel::RingChannel() : _ring(4096), _head(0), _size(0), _dropped(0), _stop(false)
+{
+}
+
+RingChannel::~RingChannel()
+{
+    close();
+}
+
+void RingChannel::setChannel(Poco::Channel* channel)
+{
+    Poco::FastMutex::ScopedLock lock(_mutex);
+    _channel.assign(channel, true);
+}
+
+void RingChannel::open()
+{
+    Poco::FastMutex::ScopedLock lock(_mutex);
+    _stop = false;
+    if (_channel) _channel->open();
+}
+
+void RingChannel::close()
+{
+    {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        _stop = true;
+    }
+    _ready.set();
+    _space.set();
+    if (_thread.isRunning()) _thread.join();
+}
+
+void RingChannel::log(const Poco::Message& msg)
+{
+    for (;;) {
+        {
+            Poco::FastMutex::ScopedLock lock(_mutex);
+            if (_stop) break; // closed, written by caller
+            if (!_thread.isRunning()) _thread.start(*this);
+
+            if (_size < _ring.size()) {
+                _ring[(_head + _size) % _ring.size()] = msg;
+                ++_size;
+                _ready.set();
+                return;
+            }
+            if (msg.getPriority() > Poco::Message::PRIO_WARNING) {
+                ++_dropped;
+                return;
+            }
+        }
+        _space.wait(); // warnings and errors are never dropped
+    }
+
+    if (_channel) _channel->log(msg);
+}
+
+void RingChannel::setProperty(const std::string& name, const std::string& value)
+{
+    if ("channel" == name)
+        setChannel(Poco::LoggingRegistry::defaultRegistry().channelForName(value));
+    else if ("capacity" == name) {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        if (_size)
+            throw Poco::IllegalStateException("Log ring is not empty");
+        _ring.assign(std::max(1, Poco::NumberParser::parse(value)), Poco::Message());
+        _head = 0;
+    } else
+        Poco::Channel::setProperty(name, value);
+}
+
+void RingChannel::registerChannel()
+{
+    Poco::LoggingFactory::defaultFactory().registerChannelClass("RingChannel",
+        new Poco::Instantiator<RingChannel, Poco::Channel>);
+}
+
+bool RingChannel::pop(Poco::Message& msg, size_t& dropped)
+{
+    {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        if (!_size) return false;
+        msg = _ring[_head];
+        _head = (_head + 1) % _ring.size();
+        --_size;
+        dropped = _dropped;
+        _dropped = 0;
+    }
+    _space.set();
+    return true;
+}
+
+void RingChannel::run()
+{
+    Poco::Message msg;
+    size_t dropped;
+    for (;;) {
+        // Formatting and file writes are done here, out of the lock
+        while (pop(msg, dropped)) {
+            if (!_channel) continue;
+            if (dropped)
+                _channel->log(Poco::Message(msg.getSource(),
+                    Poco::format("%z log messages dropped, writer is behind", dropped), Poco::Message::PRIO_WARNING));
+            _channel->log(msg);
+        }
+
+        {
+            Poco::FastMutex::ScopedLock lock(_mutex);
+            if (_stop && !_size) return;
+        }
+        _ready.wait();
+    }
+}
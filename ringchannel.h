@@ -0,0 +1,52 @@
+#ifndef RINGCHANNEL_H
+#define RINGCHANNEL_H
+
+#include <string>
+#include <vector>
+#include <Poco/Event.h>
+#include <Poco/Mutex.h>
+#include <Poco/Thread.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/Channel.h>
+#include <Poco/Message.h>
+#include <Poco/Runnable.h>
+
+// Channel passing messages to other channel from background thread.
+// Messages wait in fixed ring; when it is full notices and lower are
+// dropped and counted, warnings and errors wait for free slot.
+// Properties: channel (name of registered channel), capacity.
+class RingChannel : public Poco::Channel, public Poco::Runnable
+{
+public:
+    RingChannel();
+
+    void setChannel(Poco::Channel* channel);
+
+    void open();
+    // Write out queued messages and stop writer thread
+    void close();
+    void log(const Poco::Message& msg);
+    void setProperty(const std::string& name, const std::string& value);
+
+    // Make class available to logging configuration
+    static void registerChannel();
+
+protected:
+    ~RingChannel();
+
+private:
+    void run();
+    // Take message from ring, false if it is empty
+    bool pop(Poco::Message& msg, size_t& dropped);
+
+private:
+    Poco::AutoPtr<Poco::Channel> _channel;
+    std::vector<Poco::Message> _ring;
+    size_t _head, _size, _dropped;
+    bool _stop;
+    Poco::FastMutex _mutex;
+    Poco::Event _ready, _space;
+    Poco::Thread _thread;
+};
+
+#endif // RINGCHANNEL_H
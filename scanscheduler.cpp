@@ -0,0 +1,108 @@
+#include "scanscheduler.h"
+#include "main.h"
+
+#include <algorithm>
+#include <Poco/File.h>
+#include <Poco/Timestamp.h>
+#include <Poco/FileStream.h>
+#include <Poco/NumberParser.h>
+#include <Poco/StringTokenizer.h>
+
+ScanScheduler::ScanScheduler() : _enabled(false), _factor(0), _maxInterval(0), _now(0)
+{
+}
+
+void ScanScheduler::load(const std::string& path, Data::Site::Ptr_t site, Data::TimePoint_t now)
+{
+    _enabled = App::get().config().getBool("scan.adaptive", false);
+    _factor = App::get().config().getDouble("scan.factor", 0.1);
+    _maxInterval = Data::TimePoint_t(App::get().config().getInt("scan.maxInterval", 604800)) *
+        Poco::Timestamp::resolution();
+    _now = now;
+    _dirs.clear();
+    _skipped.clear();
+    if (!_enabled) return;
+
+    // Line is <lastChange>\t<lastScan>\t<dir>
+    if (Poco::File(path).exists()) {
+        Poco::FileInputStream in(path, std::ios::in | std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            Poco::StringTokenizer tok(line, "\t");
+            Poco::Int64 lastChange, lastScan;
+            if (3 != tok.count() || !Poco::NumberParser::tryParse64(tok[0], lastChange) ||
+                    !Poco::NumberParser::tryParse64(tok[1], lastScan))
+                continue;
+            Dir& dir = _dirs[tok[2]];
+            dir.lastChange = lastChange;
+            dir.lastScan = lastScan;
+        }
+        return;
+    }
+
+    // First run learns last change of every subtree from history, all is listed
+    const Data::StoredVersion::Map_t stored = site->storedVersions();
+    for (Data::StoredVersion::Map_t::const_iterator it = stored.begin(), end = stored.end(); it != end; ++it)
+        for (size_t pos = it->first.rfind('/'); pos && std::string::npos != pos; pos = it->first.rfind('/', pos - 1)) {
+            Dir& dir = _dirs[it->first.substr(0, pos)];
+            dir.lastChange = std::max(dir.lastChange, it->second.timePoint);
+            dir.lastScan = 0;
+        }
+}
+
+void ScanScheduler::save(const std::string& path) const
+{
+    if (!_enabled) return;
+
+    const std::string tmp = path + ".tmp";
+    {
+        Poco::FileOutputStream out(tmp, std::ios::out | std::ios::trunc | std::ios::binary);
+        for (Dirs_t::const_iterator it = _dirs.begin(), end = _dirs.end(); it != end; ++it) {
+            // Directory not listed for long is gone, or it is found again
+            if (_now - it->second.lastScan > 2 * _maxInterval && !isSkipped(it->first + "/")) continue;
+            out << it->second.lastChange << '\t' << it->second.lastScan << '\t' << it->first << '\n';
+        }
+        out.close();
+    }
+    Poco::File(tmp).renameTo(path);
+}
+
+bool ScanScheduler::enter(const std::string& dir)
+{
+    if (!_enabled) return true;
+
+    Dirs_t::iterator it = _dirs.find(dir);
+    if (_dirs.end() == it) { // new directory is hot
+        Dir& d = _dirs[dir];
+        d.lastChange = d.lastScan = _now;
+        return true;
+    }
+
+    Dir& d = it->second;
+    const Data::TimePoint_t interval = std::min(_maxInterval,
+        Data::TimePoint_t(_factor * double(_now - d.lastChange)));
+    if (_now - d.lastScan < interval) {
+        _skipped.insert(dir);
+        return false;
+    }
+    d.lastScan = _now;
+    return true;
+}
+
+bool ScanScheduler::isSkipped(const std::string& fullName) const
+{
+    if (_skipped.empty()) return false;
+    for (size_t pos = fullName.rfind('/'); pos && std::string::npos != pos; pos = fullName.rfind('/', pos - 1))
+        if (_skipped.count(fullName.substr(0, pos))) return true;
+    return false;
+}
+
+void ScanScheduler::changed(const std::string& fullName)
+{
+    if (!_enabled) return;
+    for (size_t pos = fullName.rfind('/'); pos && std::string::npos != pos; pos = fullName.rfind('/', pos - 1)) {
+        Dir& dir = _dirs[fullName.substr(0, pos)];
+        dir.lastChange = _now;
+        if (!dir.lastScan) dir.lastScan = _now;
+    }
+}
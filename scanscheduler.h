@@ -0,0 +1,43 @@
+#ifndef SCANSCHEDULER_H
+#define SCANSCHEDULER_H
+
+#include "data.h"
+#include <map>
+#include <set>
+#include <string>
+
+// Directories unchanged for long are listed less often. Directory is due when
+// time since its last scan reaches scan.factor of time since the last change
+// under it, but not more than scan.maxInterval, so every directory is listed
+// at least once per scan.maxInterval. Disabled unless scan.adaptive is set.
+class ScanScheduler
+{
+public:
+    ScanScheduler();
+
+    // State of previous runs, seeded from stored versions if file is missing
+    void load(const std::string& path, Data::Site::Ptr_t site, Data::TimePoint_t now);
+    void save(const std::string& path) const;
+
+    // False if listing of directory is skipped in this run, it is remembered then
+    bool enter(const std::string& dir);
+    // Entry is in subtree which was not listed, so it is not deleted
+    bool isSkipped(const std::string& fullName) const;
+    // Entry was added, modified or deleted, directories above it become hot
+    void changed(const std::string& fullName);
+
+private:
+    struct Dir
+    {
+        Data::TimePoint_t lastChange, lastScan;
+    };
+    typedef std::map<std::string, Dir> Dirs_t;
+
+    bool _enabled;
+    double _factor;
+    Data::TimePoint_t _maxInterval, _now;
+    Dirs_t _dirs;
+    std::set<std::string> _skipped;
+};
+
+#endif // SCANSCHEDULER_H
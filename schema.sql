@@ -0,0 +1,76 @@
+-- Metadata schema used by ftpbackup (MySQL)
+
+CREATE TABLE IF NOT EXISTS ftp_mapping (
+    id INT UNSIGNED NOT NULL PRIMARY KEY,
+    clientLogin VARCHAR(64) NOT NULL,
+    clientPasswd VARCHAR(64) NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS ftp_backup_files (
+    id INT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY,
+    siteId INT UNSIGNED NOT NULL,
+    crc32 INT UNSIGNED NOT NULL,
+    timePoint BIGINT NOT NULL,
+    fullName VARCHAR(1024) NOT NULL,
+    modifyDate VARCHAR(64) NOT NULL,
+    isDirectory TINYINT(1) NOT NULL,
+    KEY siteId (siteId),
+    KEY siteTime (siteId, timePoint)
+);
+
+-- fileStatus: 0 added, 1 modified, 2 delta, -1 deleted, -2 deleted directory
+-- (tombstone), entries under it with older versions are deleted with it
+CREATE TABLE IF NOT EXISTS ftp_backup_history (
+    fileId INT UNSIGNED NOT NULL,
+    timePoint BIGINT NOT NULL,
+    fileStatus SMALLINT NOT NULL,
+    KEY fileTime (fileId, timePoint),
+    KEY statusTime (fileStatus, timePoint)
+);
+
+-- attribute is one of ext, path, glob, regex, size, age
+CREATE TABLE IF NOT EXISTS ftp_backup_ignores (
+    siteId INT UNSIGNED NOT NULL,
+    attribute VARCHAR(16) NOT NULL,
+    operand VARCHAR(255) NOT NULL,
+    KEY siteId (siteId)
+);
+
+CREATE TABLE IF NOT EXISTS ftp_backup_snapshots (
+    siteId INT UNSIGNED NOT NULL,
+    timePoint BIGINT NOT NULL,
+    PRIMARY KEY (siteId, timePoint)
+);
+
+-- Changes counter of site files, cached manifest is valid while it matches.
+-- counter is bumped by every run changing files before its first change
+-- (and by verification invalidating a file), timePoint is the latest run.
+-- Existing sites are initialized with (no statement separator here, as the
+-- schema is split by it):
+-- INSERT IGNORE INTO ftp_backup_generations (siteId, counter, timePoint)
+--     SELECT siteId, COUNT(*), MAX(timePoint) FROM ftp_backup_files GROUP BY siteId
+CREATE TABLE IF NOT EXISTS ftp_backup_generations (
+    siteId INT UNSIGNED NOT NULL PRIMARY KEY,
+    counter BIGINT NOT NULL,
+    timePoint BIGINT NOT NULL
+);
+
+-- Sites shared by several ftpbackup instances (lease.enabled), times are
+-- UNIX_TIMESTAMP() of database server. Row of finished run keeps expires 0
+CREATE TABLE IF NOT EXISTS ftp_backup_leases (
+    siteId INT UNSIGNED NOT NULL PRIMARY KEY,
+    owner VARCHAR(128) NOT NULL,
+    expires BIGINT NOT NULL,
+    finished BIGINT NOT NULL
+);
+
+-- Results of --verify, archive is file name without codec extension
+CREATE TABLE IF NOT EXISTS ftp_backup_verify (
+    siteId INT UNSIGNED NOT NULL,
+    archive VARCHAR(64) NOT NULL,
+    checked BIGINT NOT NULL,
+    members INT UNSIGNED NOT NULL,
+    bad INT UNSIGNED NOT NULL,
+    error VARCHAR(255) NOT NULL,
+    PRIMARY KEY (siteId, archive)
+);
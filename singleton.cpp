@@ -1,10 +1,13 @@
 #include "singleton.h"
+#include "tracer.h"
 #include "main.h"
 
+#include <limits>
 #include <Poco/Data/SessionFactory.h>
 #include <Poco/Data/MySQL/SessionImpl.h>
 
 using Poco::Data::use;
+using Poco::Data::into;
 using Poco::Data::SessionFactory;
 using Poco::Data::Statement;
 using Poco::Data::RecordSet;
@@ -14,26 +17,51 @@ using Poco::Data::MySQL::SessionImpl;
 
 Data::Singleton::Singleton() : _counter(0),
     _ses(SessionFactory::instance().create(Connector::KEY, App::config("mysql.connection"))),
-    _selectTrunk(_ses), _selectHistory(_ses), _selectIgnores(_ses),
-    _insFile(_ses), _updFile(_ses), _insHistory(_ses)
+    _selectTrunk(_ses), _selectHistory(_ses), _selectTombstones(_ses), _selectIgnores(_ses), _selectVersions(_ses),
+    _selectSnapshots(_ses), _selectGeneration(_ses), _bumpGeneration(_ses), _insFile(_ses), _updFile(_ses),
+    _insHistory(_ses), _touchFile(_ses), _insSnapshot(_ses), _delSnapshot(_ses), _claimLease(_ses),
+    _renewLease(_ses), _finishLease(_ses), _releaseLease(_ses), _selectLeaseHolder(_ses), _selectStored(_ses),
+    _invalidateFile(_ses), _bumpFileGeneration(_ses), _selectVerified(_ses), _insVerify(_ses)
 {
-    // Select files with last changed attributes
-    _selectTrunk << "SELECT f.id, f.crc32, f.fullName, f.isDirectory, f.modifyDate"
+    // Select files with last changed attributes, timePoint is compared with tombstones
+    _selectTrunk << "SELECT f.id, f.crc32, f.fullName, f.isDirectory, f.modifyDate, f.timePoint"
         " FROM ftp_backup_files f join ftp_backup_history h"
         " on h.fileId = f.id  and h.timePoint = f.timePoint"
-        " and h.fileStatus <> -1 WHERE f.siteId = ?", new UB(_cache.siteId);
+        " and h.fileStatus >= 0 WHERE f.siteId = ?", new UB(_cache.siteId);
 
     // Select files by timestamp revision. Column mapping crc32 => fileStatus, modifyDate => timePoint
     _selectHistory << "SELECT f.id, CAST(h.fileStatus AS UNSIGNED),"
         " f.fullName, f.isDirectory, CAST(MAX(h.timePoint) AS CHAR)"
         " FROM ftp_backup_files f join ftp_backup_history h on h.fileId = f.id"
-        " WHERE h.timePoint <= ? and f.siteId = ?"
+        " WHERE h.timePoint <= ? and f.siteId = ? and f.fullName LIKE ?"
         " GROUP BY f.id, h.fileStatus, f.fullName, f.isDirectory",
+        use(_cache.timePoint), new UB(_cache.siteId), use(_cache.fileNameLike);
+
+    // Prefix of files query is not applied, tombstone may be above it
+    _selectTombstones << "SELECT f.fullName, MAX(h.timePoint)"
+        " FROM ftp_backup_history h join ftp_backup_files f on f.id = h.fileId"
+        " WHERE h.fileStatus = -2 and h.timePoint <= ? and f.siteId = ?"
+        " GROUP BY f.fullName",
         use(_cache.timePoint), new UB(_cache.siteId);
 
     _selectIgnores << "SELECT DISTINCT attribute, operand"
         " FROM ftp_backup_ignores WHERE siteId = ?", new UB(_cache.siteId);
 
+    // All changes of one file up to timestamp, latest first
+    _selectVersions << "SELECT timePoint, fileStatus FROM ftp_backup_history"
+        " WHERE fileId = ? and timePoint <= ? ORDER BY timePoint DESC",
+        new UB(_cache.fileId), use(_cache.timePoint);
+
+    _selectSnapshots << "SELECT timePoint FROM ftp_backup_snapshots"
+        " WHERE siteId = ? ORDER BY timePoint", new UB(_cache.siteId);
+
+    // Counter is bumped once by every run changing files, site without row has not changed since schema update
+    _selectGeneration << "SELECT counter, timePoint FROM ftp_backup_generations WHERE siteId = ?",
+        into(_cache.generation.count), into(_cache.generation.timePoint), new UB(_cache.siteId);
+    _bumpGeneration << "INSERT INTO ftp_backup_generations (siteId, counter, timePoint) VALUES (?, 1, ?)"
+        " ON DUPLICATE KEY UPDATE counter = counter + 1, timePoint = GREATEST(timePoint, VALUES(timePoint))",
+        new UB(_cache.siteId), use(_cache.timePoint);
+
     //Insert only new found files
     _insFile << "INSERT INTO ftp_backup_files"
         " (siteId, crc32, timePoint, fullName, modifyDate, isDirectory)"
@@ -48,57 +76,178 @@ Data::Singleton::Singleton() : _counter(0),
         new UB(_cache.fileCrc32), use(_cache.timePoint), use(_cache.fileModifyDate),
         use(_cache.fileIsDirectory), new UB(_cache.fileId);
 
+    // Same content listed with other modify date
+    _touchFile << "UPDATE ftp_backup_files SET modifyDate = ? WHERE id = ?",
+        use(_cache.fileModifyDate), new UB(_cache.fileId);
+
     // Save all file statatus changes (INS, UPD and DEL)
     _insHistory << "INSERT INTO ftp_backup_history"
         " (fileId, timePoint, fileStatus) VALUES (?, ?, ?)",
         new UB(_cache.fileId), use(_cache.timePoint), use(_cache.fileStatus);
+
+    // Synthetic full archives made by compaction
+    _insSnapshot << "INSERT INTO ftp_backup_snapshots (siteId, timePoint) VALUES (?, ?)",
+        new UB(_cache.siteId), use(_cache.timePoint);
+    _delSnapshot << "DELETE FROM ftp_backup_snapshots WHERE siteId = ? and timePoint = ?",
+        new UB(_cache.siteId), use(_cache.timePoint);
+
+    // Lease is taken over if it is expired and site was not finished in last age seconds.
+    // Assignments are evaluated in order, so expires follows owner only if it became ours;
+    // the same owner renews its lease only if site was not finished recently too
+    _claimLease << "INSERT INTO ftp_backup_leases (siteId, owner, expires, finished)"
+        " VALUES (?, ?, UNIX_TIMESTAMP() + ?, 0) ON DUPLICATE KEY UPDATE"
+        " owner = IF(expires < UNIX_TIMESTAMP() AND finished < UNIX_TIMESTAMP() - ?, VALUES(owner), owner),"
+        " expires = IF(owner = VALUES(owner) AND finished < UNIX_TIMESTAMP() - ?, VALUES(expires), expires)",
+        new UB(_cache.siteId), use(_cache.leaseOwner), use(_cache.leaseTtl), use(_cache.leaseAge),
+        use(_cache.leaseAge);
+    _renewLease << "UPDATE ftp_backup_leases SET expires = UNIX_TIMESTAMP() + ?"
+        " WHERE siteId = ? and owner = ?",
+        use(_cache.leaseTtl), new UB(_cache.siteId), use(_cache.leaseOwner);
+    _finishLease << "UPDATE ftp_backup_leases SET expires = 0, finished = UNIX_TIMESTAMP()"
+        " WHERE siteId = ? and owner = ?",
+        new UB(_cache.siteId), use(_cache.leaseOwner);
+    // Failed run gives site back, finished time is kept so it is not skipped as recent
+    _releaseLease << "UPDATE ftp_backup_leases SET expires = 0 WHERE siteId = ? and owner = ?",
+        new UB(_cache.siteId), use(_cache.leaseOwner);
+    // Only live lease has holder, refused claim of the same owner is not taken for success
+    _selectLeaseHolder << "SELECT owner FROM ftp_backup_leases WHERE siteId = ? and expires > UNIX_TIMESTAMP()",
+        into(_cache.leaseHolder), new UB(_cache.siteId);
+
+    // Current version of every regular file with all its changes up to it, latest first,
+    // delta chain of the current version is followed back to full version
+    _selectStored << "SELECT f.id, f.crc32, f.fullName, f.timePoint, h.fileStatus, h.timePoint"
+        " FROM ftp_backup_files f join ftp_backup_history h"
+        " on h.fileId = f.id and h.timePoint <= f.timePoint"
+        " WHERE f.siteId = ? and f.isDirectory = 0 ORDER BY f.id, h.timePoint DESC", new UB(_cache.siteId);
+
+    // Empty modify date and zero checksum make the next run store full version
+    _invalidateFile << "UPDATE ftp_backup_files SET modifyDate = '', crc32 = 0 WHERE id = ?",
+        new UB(_cache.fileId);
+    _bumpFileGeneration << "INSERT INTO ftp_backup_generations (siteId, counter, timePoint)"
+        " SELECT siteId, 1, 0 FROM ftp_backup_files WHERE id = ? ON DUPLICATE KEY UPDATE counter = counter + 1",
+        new UB(_cache.fileId);
+
+    _selectVerified << "SELECT archive FROM ftp_backup_verify"
+        " WHERE siteId = ? and checked >= ? and bad = 0 and error = ''",
+        new UB(_cache.siteId), use(_cache.timePoint);
+    _insVerify << "REPLACE INTO ftp_backup_verify (siteId, archive, checked, members, bad, error)"
+        " VALUES (?, ?, ?, ?, ?, ?)",
+        new UB(_cache.siteId), use(_cache.archive), use(_cache.timePoint),
+        new UB(_cache.verifyMembers), new UB(_cache.verifyBad), use(_cache.verifyError);
 }
 
-Data::Singleton::RecordSetPtr_t Data::Singleton::selectFiles(unsigned siteId, TimePoint_t tp)
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectFiles(unsigned siteId, TimePoint_t tp, const std::string& prefix)
 {
-    Poco::FastMutex::ScopedLock lock(_mutex);
+    Tracer::ScopedLock lock(_mutex, "db", "selectFiles");
     _cache.siteId = siteId;
     _cache.timePoint = tp;
 
+    // Prefix is literal in LIKE pattern
+    _cache.fileNameLike.clear();
+    for (size_t i = 0, count = prefix.size(); i < count; ++i) {
+        if ('%' == prefix[i] || '_' == prefix[i] || '\\' == prefix[i]) _cache.fileNameLike += '\\';
+        _cache.fileNameLike += prefix[i];
+    }
+    _cache.fileNameLike += '%';
+
     Statement &stmt = tp ? _selectHistory : _selectTrunk;
     // Return null object if selected rows count is 0
     return RecordSetPtr_t(stmt.execute() ? new RecordSet(stmt) : 0);
 }
 
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectTombstones(unsigned siteId, TimePoint_t tp)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "selectTombstones");
+    _cache.siteId = siteId;
+    _cache.timePoint = tp ? tp : std::numeric_limits<TimePoint_t>::max();
+
+    return RecordSetPtr_t(
+        _selectTombstones.execute() ? new RecordSet(_selectTombstones) : 0);
+}
+
 Data::Singleton::RecordSetPtr_t Data::Singleton::selectIgnores(unsigned siteId)
 {
-    Poco::FastMutex::ScopedLock lock(_mutex);
+    Tracer::ScopedLock lock(_mutex, "db", "selectIgnores");
     _cache.siteId = siteId;
 
     return RecordSetPtr_t(
         _selectIgnores.execute() ? new RecordSet(_selectIgnores) : 0);
 }
 
-void Data::Singleton::addFile(unsigned siteId, const File& file)
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectVersions(unsigned fileId, TimePoint_t tp)
 {
-    Poco::FastMutex::ScopedLock lock(_mutex);
-    bindCache(siteId, file);
+    Tracer::ScopedLock lock(_mutex, "db", "selectVersions");
+    _cache.fileId = fileId;
+    _cache.timePoint = tp;
+
+    return RecordSetPtr_t(
+        _selectVersions.execute() ? new RecordSet(_selectVersions) : 0);
+}
+
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectSnapshots(unsigned siteId)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "selectSnapshots");
+    _cache.siteId = siteId;
+
+    return RecordSetPtr_t(
+        _selectSnapshots.execute() ? new RecordSet(_selectSnapshots) : 0);
+}
+
+Data::Generation Data::Singleton::selectGeneration(unsigned siteId)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "selectGeneration");
+    _cache.siteId = siteId;
+    _cache.generation.count = 0;
+    _cache.generation.timePoint = 0;
+    _selectGeneration.execute();
+    return _cache.generation;
+}
+
+void Data::Singleton::addSnapshot(unsigned siteId, TimePoint_t tp)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "addSnapshot");
+    _cache.siteId = siteId;
+    _cache.timePoint = tp;
+    _insSnapshot.execute();
+}
+
+void Data::Singleton::delSnapshot(unsigned siteId, TimePoint_t tp)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "delSnapshot");
+    _cache.siteId = siteId;
+    _cache.timePoint = tp;
+    _delSnapshot.execute();
+}
+
+unsigned Data::Singleton::addFile(unsigned siteId, TimePoint_t tp, const File& file)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "addFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
 
     _insFile.execute();
     _cache.fileId = Poco::AnyCast<Poco::UInt64>(static_cast<SessionImpl*>(_ses.impl())->getInsertId(""));
     _cache.fileStatus = File::Added;
     _insHistory.execute();
+    return _cache.fileId;
 }
 
-void Data::Singleton::updFile(unsigned siteId, const File& file)
+void Data::Singleton::updFile(unsigned siteId, TimePoint_t tp, const File& file)
 {
-    Poco::FastMutex::ScopedLock lock(_mutex);
-    bindCache(siteId, file);
+    Tracer::ScopedLock lock(_mutex, "db", "updFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
 
     _cache.fileStatus = File::Modified;
     _insHistory.execute();
     _updFile.execute();
 }
 
-void Data::Singleton::delFile(unsigned siteId, const File& file)
+void Data::Singleton::delFile(unsigned siteId, TimePoint_t tp, const File& file)
 {
-    Poco::FastMutex::ScopedLock lock(_mutex);
-    bindCache(siteId, file);
+    Tracer::ScopedLock lock(_mutex, "db", "delFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
 
     _cache.fileStatus = File::Deleted;
     _cache.fileModifyDate.clear(); // additional information to recognize deleted files
@@ -106,6 +255,119 @@ void Data::Singleton::delFile(unsigned siteId, const File& file)
     _updFile.execute();
 }
 
+void Data::Singleton::deltaFile(unsigned siteId, TimePoint_t tp, const File& file)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "deltaFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
+
+    _cache.fileStatus = File::Delta;
+    _insHistory.execute();
+    _updFile.execute();
+}
+
+void Data::Singleton::touchFile(unsigned siteId, TimePoint_t tp, const File& file)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "touchFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
+    _touchFile.execute();
+}
+
+void Data::Singleton::tombstoneFile(unsigned siteId, TimePoint_t tp, const File& file)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "tombstoneFile");
+    bindCache(siteId, tp, file);
+    bumpGeneration();
+
+    _cache.fileStatus = File::Tombstone;
+    _cache.fileModifyDate.clear();
+    _insHistory.execute();
+    _updFile.execute();
+}
+
+bool Data::Singleton::claimLease(unsigned siteId, const std::string& owner, int ttl, int age)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "claimLease");
+    _cache.siteId = siteId;
+    _cache.leaseOwner = owner;
+    _cache.leaseTtl = ttl;
+    _cache.leaseAge = age;
+    _claimLease.execute();
+
+    _cache.leaseHolder.clear();
+    _selectLeaseHolder.execute();
+    return owner == _cache.leaseHolder;
+}
+
+bool Data::Singleton::renewLease(unsigned siteId, const std::string& owner, int ttl)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "renewLease");
+    _cache.siteId = siteId;
+    _cache.leaseOwner = owner;
+    _cache.leaseTtl = ttl;
+    _renewLease.execute();
+
+    _cache.leaseHolder.clear();
+    _selectLeaseHolder.execute();
+    return owner == _cache.leaseHolder;
+}
+
+void Data::Singleton::finishLease(unsigned siteId, const std::string& owner)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "finishLease");
+    _cache.siteId = siteId;
+    _cache.leaseOwner = owner;
+    _finishLease.execute();
+}
+
+void Data::Singleton::releaseLease(unsigned siteId, const std::string& owner)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "releaseLease");
+    _cache.siteId = siteId;
+    _cache.leaseOwner = owner;
+    _releaseLease.execute();
+}
+
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectStored(unsigned siteId)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "selectStored");
+    _cache.siteId = siteId;
+
+    return RecordSetPtr_t(
+        _selectStored.execute() ? new RecordSet(_selectStored) : 0);
+}
+
+void Data::Singleton::invalidateFile(unsigned fileId)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "invalidateFile");
+    _cache.fileId = fileId;
+    _invalidateFile.execute();
+    _bumpFileGeneration.execute();
+}
+
+Data::Singleton::RecordSetPtr_t Data::Singleton::selectVerified(unsigned siteId, TimePoint_t since)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "selectVerified");
+    _cache.siteId = siteId;
+    _cache.timePoint = since;
+
+    return RecordSetPtr_t(
+        _selectVerified.execute() ? new RecordSet(_selectVerified) : 0);
+}
+
+void Data::Singleton::addVerification(unsigned siteId, const std::string& archive, TimePoint_t checked,
+                                      unsigned members, unsigned bad, const std::string& error)
+{
+    Tracer::ScopedLock lock(_mutex, "db", "addVerification");
+    _cache.siteId = siteId;
+    _cache.archive = archive;
+    _cache.timePoint = checked;
+    _cache.verifyMembers = members;
+    _cache.verifyBad = bad;
+    _cache.verifyError = error.substr(0, 255);
+    _insVerify.execute();
+}
 
 void Data::Singleton::incrementUsage()
 {
@@ -126,7 +388,17 @@ Data::Singleton &Data::Singleton::getInstance()
     return *_singleton;
 }
 
-void Data::Singleton::bindCache(unsigned siteId, const File& file)
+void Data::Singleton::bumpGeneration()
+{
+    // Run bumps it before its first change, so manifest of earlier generation is not
+    // taken even if the run is interrupted, and manifest saved by the run is of this one
+    TimePoint_t& bumped = _bumped[_cache.siteId];
+    if (bumped == _cache.timePoint) return;
+    _bumpGeneration.execute();
+    bumped = _cache.timePoint;
+}
+
+void Data::Singleton::bindCache(unsigned siteId, TimePoint_t tp, const File& file)
 {
     _cache.siteId = siteId;
     _cache.fileId = file.id;
@@ -134,5 +406,5 @@ void Data::Singleton::bindCache(unsigned siteId, const File& file)
     _cache.fileFullName = file.fullName;
     _cache.fileIsDirectory = file.isDirectory;
     _cache.fileModifyDate = file.modifyDate;
-    _cache.timePoint = Data::currentTimePoint();
+    _cache.timePoint = tp;
 }
@@ -32,11 +32,16 @@ class Data::Singleton
     struct BindCache
     {
         unsigned fileId, fileCrc32;
-        std::string fileFullName, fileModifyDate;
+        std::string fileFullName, fileModifyDate, fileNameLike;
         bool fileIsDirectory;
         short fileStatus;
         unsigned siteId;
         TimePoint_t timePoint;
+        Generation generation;
+        std::string leaseOwner, leaseHolder;
+        int leaseTtl, leaseAge;
+        std::string archive, verifyError;
+        unsigned verifyMembers, verifyBad;
     };
 
 public:
@@ -46,13 +51,39 @@ public:
 
     Poco::Data::Session& dbSession() { return _ses; }
 
-    RecordSetPtr_t selectFiles(unsigned siteId, TimePoint_t tp = 0);
+    RecordSetPtr_t selectFiles(unsigned siteId, TimePoint_t tp = 0, const std::string& prefix = std::string());
+    // Latest tombstone of every directory up to tp, all if tp is 0
+    RecordSetPtr_t selectTombstones(unsigned siteId, TimePoint_t tp);
     RecordSetPtr_t selectIgnores(unsigned siteId);
-
-    void addFile(unsigned siteId, const File& file);
-
-    void updFile(unsigned siteId, const File& file);
-    void delFile(unsigned siteId, const File& file);
+    RecordSetPtr_t selectVersions(unsigned fileId, TimePoint_t tp);
+    RecordSetPtr_t selectSnapshots(unsigned siteId);
+    Generation selectGeneration(unsigned siteId);
+
+    void addSnapshot(unsigned siteId, TimePoint_t tp);
+    void delSnapshot(unsigned siteId, TimePoint_t tp);
+
+    // Return id of inserted file
+    unsigned addFile(unsigned siteId, TimePoint_t tp, const File& file);
+
+    void updFile(unsigned siteId, TimePoint_t tp, const File& file);
+    void delFile(unsigned siteId, TimePoint_t tp, const File& file);
+    void deltaFile(unsigned siteId, TimePoint_t tp, const File& file);
+    // Modify date only, no history record
+    void touchFile(unsigned siteId, TimePoint_t tp, const File& file);
+    void tombstoneFile(unsigned siteId, TimePoint_t tp, const File& file);
+
+    // Lease rows share sites between instances, times are taken from database clock
+    bool claimLease(unsigned siteId, const std::string& owner, int ttl, int age);
+    bool renewLease(unsigned siteId, const std::string& owner, int ttl);
+    void finishLease(unsigned siteId, const std::string& owner);
+    void releaseLease(unsigned siteId, const std::string& owner);
+
+    // Archive verification (--verify)
+    RecordSetPtr_t selectStored(unsigned siteId);
+    void invalidateFile(unsigned fileId);
+    RecordSetPtr_t selectVerified(unsigned siteId, TimePoint_t since);
+    void addVerification(unsigned siteId, const std::string& archive, TimePoint_t checked,
+                         unsigned members, unsigned bad, const std::string& error);
 
     void incrementUsage();
     bool decrementUsage();
@@ -60,16 +91,22 @@ public:
     static Singleton &getInstance();
 
 private:
-    void bindCache(unsigned siteId, const File& file);
+    void bindCache(unsigned siteId, TimePoint_t tp, const File& file);
+    // Generation of cached site is bumped by the first change of run at cached time point
+    void bumpGeneration();
 
 private:
     unsigned _counter;
     Poco::FastMutex _mutex;
+    std::map<unsigned, TimePoint_t> _bumped; // by site, time point of run which bumped generation
 
     BindCache _cache;
     Poco::Data::Session _ses;
-    Poco::Data::Statement _selectTrunk, _selectHistory, _selectIgnores,
-        _insFile, _updFile, _insHistory;
+    Poco::Data::Statement _selectTrunk, _selectHistory, _selectTombstones, _selectIgnores, _selectVersions,
+        _selectSnapshots, _selectGeneration, _bumpGeneration, _insFile, _updFile, _insHistory,
+        _touchFile, _insSnapshot, _delSnapshot,
+        _claimLease, _renewLease, _finishLease, _releaseLease, _selectLeaseHolder,
+        _selectStored, _invalidateFile, _bumpFileGeneration, _selectVerified, _insVerify;
 };
 
 #endif // SINGLETON_H
@@ -0,0 +1,444 @@
+#include "ignorematcher.h"
+#include "globautomaton.h"
+#include "listparser.h"
+#include "archivereader.h"
+#include "binarydelta.h"
+#include "codec.h"
+#include "main.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <zstd.h>
+#include <Poco/File.h>
+#include <Poco/FileStream.h>
+#include <Poco/Exception.h>
+
+const std::string App::EmptyString;
+
+// Checks of parsers, matchers, archive reader and binary delta which need no ftp server or database.
+// Every failed check is printed, exit code is count of failures
+namespace
+{
+    int failures = 0;
+
+    void check(bool ok, const char* expr, const char* file, int line)
+    {
+        if (ok) return;
+        std::cerr << file << ':' << line << ": check failed: " << expr << std::endl;
+        ++failures;
+    }
+
+    #define CHECK(expr) check((expr), #expr, __FILE__, __LINE__)
+
+    Data::Ignore::Ptr_t rule(Data::Ignore::Attribute attribute, const std::string& operand)
+    {
+        Data::Ignore::Ptr_t ignore(new Data::Ignore);
+        ignore->attribute = attribute;
+        ignore->operand = operand;
+        return ignore;
+    }
+
+    void testIgnoreGlob()
+    {
+        Data::Ignore::List_t ignores;
+        ignores.push_back(rule(Data::Ignore::AttributeGlob, "*.log"));
+        ignores.push_back(rule(Data::Ignore::AttributeGlob, "/www/cache/*"));
+        IgnoreMatcher matcher;
+        matcher.compile(ignores, 0);
+
+        // Base name glob matches at any depth, but only whole base name
+        CHECK(matcher.matchName("/x.log"));
+        CHECK(matcher.matchName("/dir/x.log"));
+        CHECK(matcher.matchName("/www/dir/sub/error.log"));
+        CHECK(!matcher.matchName("/dir/x.log.gz"));
+        CHECK(!matcher.matchName("/x.log/file"));
+        // Glob with separator matches full name
+        CHECK(matcher.matchName("/www/cache/a/b"));
+        CHECK(!matcher.matchName("/site/www/cache/a"));
+        CHECK(!matcher.matchName("/www/cache"));
+    }
+
+    void testGlobAutomaton()
+    {
+        std::vector<std::string> globs;
+        globs.push_back("/www/cache/*");
+        globs.push_back("/www/cache.txt");
+        globs.push_back("/www/img[0-9]/*.jp?");
+        globs.push_back("/www/[!a-c]x");
+        globs.push_back("/open[");
+        GlobAutomaton automaton(globs);
+
+        // Literals sharing prefix, * crosses separator and may be empty
+        CHECK(automaton.match("/www/cache/"));
+        CHECK(automaton.match("/www/cache/a/b"));
+        CHECK(automaton.match("/www/cache.txt"));
+        CHECK(!automaton.match("/www/cache"));
+        CHECK(!automaton.match("/www/cache.txt2"));
+        // Sets, ranges and complement
+        CHECK(automaton.match("/www/img5/a/b.jpg"));
+        CHECK(automaton.match("/www/img0/.jpe"));
+        CHECK(!automaton.match("/www/imgx/a.jpg"));
+        CHECK(!automaton.match("/www/img5/a.jpeg"));
+        CHECK(automaton.match("/www/dx"));
+        CHECK(!automaton.match("/www/bx"));
+        CHECK(automaton.match("/open["));
+        CHECK(!automaton.match(""));
+
+        // States built by earlier subjects give the same answers
+        CHECK(automaton.match("/www/cache/a/b"));
+        CHECK(!automaton.match("/www/bx"));
+
+        std::vector<std::string> any(1, "*");
+        GlobAutomaton all(any);
+        CHECK(all.match(""));
+        CHECK(all.match("/a/b"));
+        GlobAutomaton none((std::vector<std::string>()));
+        CHECK(!none.match(""));
+        CHECK(!none.match("/a"));
+    }
+
+    void testIgnoreRegex()
+    {
+        Data::Ignore::List_t ignores;
+        ignores.push_back(rule(Data::Ignore::AttributeRegex, "session_[0-9a-f]+"));
+        ignores.push_back(rule(Data::Ignore::AttributeRegex, "^/tmp/"));
+        IgnoreMatcher matcher;
+        matcher.compile(ignores, 0);
+
+        // Regex matches any part of full name unless it is anchored
+        CHECK(matcher.matchName("/www/dir/session_1f2e"));
+        CHECK(matcher.matchName("/session_ab.dat"));
+        CHECK(!matcher.matchName("/www/dir/session_"));
+        CHECK(matcher.matchName("/tmp/x"));
+        CHECK(!matcher.matchName("/www/tmp/x"));
+    }
+
+    void testIgnoreExt()
+    {
+        Data::Ignore::List_t ignores;
+        ignores.push_back(rule(Data::Ignore::AttributeExt, "tmp"));
+        IgnoreMatcher matcher;
+        matcher.compile(ignores, 0);
+
+        CHECK(matcher.matchName("/a/b/c.tmp"));
+        CHECK(!matcher.matchName("/a/b.tmp/c"));
+    }
+
+    void testPathFilterExact()
+    {
+        std::set<std::string> names;
+        names.insert("/www/a[1].jpg");
+        names.insert("/www/dir/*.txt");
+        const PathFilter filter(names);
+
+        // Names are literal, neither globs nor subtrees
+        CHECK(!filter.empty());
+        CHECK("/www/" == filter.prefix());
+        CHECK(filter.match("/www/a[1].jpg"));
+        CHECK(filter.match("/www/dir/*.txt"));
+        CHECK(!filter.match("/www/a1.jpg"));
+        CHECK(!filter.match("/www/dir/x.txt"));
+        CHECK(!filter.match("/www/a[1].jpg/x"));
+    }
+
+    void testPathFilterWholeSite()
+    {
+        std::vector<std::string> patterns;
+        patterns.push_back("/www/*.txt");
+        const PathFilter filter(patterns);
+        CHECK(!filter.empty());
+        CHECK("/www/" == filter.prefix());
+        CHECK(filter.match("/www/a.txt"));
+        CHECK(filter.match("/www/a.txt/b"));
+        CHECK(!filter.match("/etc/a"));
+
+        // "/" among other patterns is whole site, whatever comes before or after it
+        patterns.push_back("/");
+        patterns.push_back("/etc");
+        const PathFilter site(patterns);
+        CHECK(site.empty());
+        CHECK(site.prefix().empty());
+        CHECK(site.match("/etc/a"));
+        CHECK(site.match("/var/x"));
+        CHECK(site.match("/www/a.txt"));
+    }
+
+    void testParseMLSD()
+    {
+        std::string name;
+        ListParser::Facts_t facts;
+
+        // Name follows the first space, so ';' and spaces are part of it
+        CHECK(ListParser::parseMLSD("type=file;size=10;modify=20260101120000; a;b c.txt\r", name, facts));
+        CHECK("a;b c.txt" == name);
+        CHECK(3 == facts.size() && "file" == facts["type"] && "10" == facts["size"]);
+        CHECK("20260101120000" == facts["modify"]);
+
+        // Server sending no space has name after the last ';'
+        CHECK(ListParser::parseMLSD("type=dir;perm=el;www", name, facts));
+        CHECK("www" == name && "dir" == facts["type"] && "el" == facts["perm"]);
+
+        // Fact without value is skipped, facts of previous line are cleared
+        CHECK(ListParser::parseMLSD("type=file;bogus; x", name, facts));
+        CHECK("x" == name && 1 == facts.size());
+
+        CHECK(!ListParser::parseMLSD("type=cdir; .", name, facts));
+        CHECK(!ListParser::parseMLSD("type=pdir; ..\r", name, facts));
+        CHECK(!ListParser::parseMLSD("type=file; ", name, facts));
+    }
+
+    void testParseName()
+    {
+        CHECK("file.txt" == ListParser::parseName("/www/dir/file.txt\r"));
+        CHECK("file.txt" == ListParser::parseName("file.txt"));
+        CHECK(ListParser::parseName("/www/dir/.\r").empty());
+        CHECK(ListParser::parseName("..").empty());
+        CHECK(".htaccess" == ListParser::parseName("/www/.htaccess"));
+    }
+
+    void testParseLongYear()
+    {
+        std::string name, size, modify;
+        bool isDirectory;
+
+        // Recent file has time, month after current one is of last year
+        CHECK(ListParser::parseLong("-rw-r--r--  1 user group 1024 Dec 24 15:30 a b.txt", 2026, 4,
+                                    name, isDirectory, size, modify));
+        CHECK("a b.txt" == name && !isDirectory && "1024" == size);
+        CHECK("202512241530" == modify);
+
+        // Half a year later the same file is listed with year, date is of day precision
+        CHECK(ListParser::parseLong("-rw-r--r--  1 user group 1024 Dec 24  2025 a b.txt", 2026, 8,
+                                    name, isDirectory, size, modify));
+        CHECK("20251224" == modify);
+    }
+
+    void testListOffset()
+    {
+        int offset = 0;
+        // Server two hours ahead of UTC, MDTM seconds do not matter
+        CHECK(ListParser::utcOffset("202512241530", "20251224132959", offset));
+        CHECK(7200 == offset);
+        CHECK(ListParser::utcOffset("202512240005", "20251224053000", offset));
+        CHECK(-5 * 3600 - 1800 == offset);
+        CHECK(!ListParser::utcOffset("20251224", "20251224132959", offset));
+
+        std::string modify = "202601010030";
+        ListParser::toUtc(modify, 7200);
+        CHECK("202512312230" == modify);
+        modify = "20260101";
+        ListParser::toUtc(modify, 7200);
+        CHECK("20260101" == modify); // day is left local
+    }
+
+    void testSameModify()
+    {
+        const std::string stored = "20251224133012"; // MLSD, UTC with seconds
+        CHECK(ListParser::sameModify(stored.data(), stored.size(), "20251224133012"));
+        CHECK(!ListParser::sameModify(stored.data(), stored.size(), "20251224133013"));
+        // LIST of minute precision converted to UTC
+        CHECK(ListParser::sameModify(stored.data(), stored.size(), "202512241330"));
+        CHECK(!ListParser::sameModify(stored.data(), stored.size(), "202512241331"));
+        // Day listing is local, 13:30 UTC is the next day at UTC+11
+        CHECK(ListParser::sameModify(stored.data(), stored.size(), "20251224", 7200));
+        CHECK(!ListParser::sameModify(stored.data(), stored.size(), "20251224", 11 * 3600));
+        CHECK(ListParser::sameModify(stored.data(), stored.size(), "20251225", 11 * 3600));
+        const std::string minute = "202512241330";
+        CHECK(ListParser::sameModify(minute.data(), minute.size(), "20251224", 7200));
+        // Stored day one is compared at its precision too
+        const std::string day = "20251224";
+        CHECK(ListParser::sameModify(day.data(), day.size(), "20251224"));
+        CHECK(!ListParser::sameModify(day.data(), day.size(), "20251225"));
+        CHECK(!ListParser::sameModify(stored.data(), stored.size(), ""));
+        const std::string empty;
+        CHECK(!ListParser::sameModify(empty.data(), empty.size(), "20251224"));
+    }
+
+    // ustar member with header checksum, content padded to block
+    void tarMember(std::string& tar, const std::string& name, char type, const std::string& content)
+    {
+        char header[512] = { 0 };
+        strncpy(header, name.c_str(), 100);
+        strcpy(header + 100, "0000644");
+        sprintf(header + 124, "%011o", static_cast<unsigned>(content.size()));
+        sprintf(header + 136, "%011o", 0u);
+        header[156] = type;
+        memcpy(header + 257, "ustar\0" "00", 8);
+        memset(header + 148, ' ', 8);
+        unsigned sum = 0;
+        for (int i = 0; i < 512; ++i) sum += static_cast<unsigned char>(header[i]);
+        sprintf(header + 148, "%06o", sum);
+        tar.append(header, 512);
+        tar += content;
+        tar.append((512 - content.size() % 512) % 512, '\0');
+    }
+
+    std::string zstdFrame(const std::string& data, bool checksum)
+    {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, checksum ? 1 : 0);
+        std::string frame(ZSTD_compressBound(data.size()), '\0');
+        const size_t size = ZSTD_compress2(cctx, &frame[0], frame.size(), data.data(), data.size());
+        ZSTD_freeCCtx(cctx);
+        frame.resize(ZSTD_isError(size) ? 0 : size);
+        return frame;
+    }
+
+    void writeFile(const std::string& path, const std::string& data)
+    {
+        Poco::FileOutputStream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(data.data(), data.size());
+    }
+
+    // Names, types and content of all members, or error text
+    std::string readArchive(const std::string& path, const Codec& codec)
+    {
+        std::string ret;
+        try {
+            ArchiveReader reader(path, codec);
+            ArchiveReader::Entry entry;
+            char buffer[100];
+            while (reader.next(entry)) {
+                ret += entry.name + (ArchiveReader::Entry::Directory == entry.type ? "/" : "") + "=";
+                if ("./skipped" == entry.name) continue; // rest of member is skipped by next()
+                for (std::streamsize n; (n = reader.read(buffer, sizeof(buffer))) > 0; )
+                    ret.append(buffer, n);
+                ret += ";";
+            }
+        } catch (Poco::Exception& ex) {
+            ret += "error";
+        }
+        return ret;
+    }
+
+    std::string sampleTar(std::string& expected)
+    {
+        std::string tar, big;
+        for (int i = 0; i < 1500; ++i) big += char('a' + i % 26);
+        tarMember(tar, "./dir", '5', "");
+        tarMember(tar, "./dir/a.txt", '0', "hello");
+        tarMember(tar, "./skipped", '0', std::string(700, 'x'));
+        tarMember(tar, "./dir/big", '0', big);
+        tarMember(tar, "./empty", '0', "");
+        tar.append(1024, '\0');
+        expected = "./dir/=;./dir/a.txt=hello;./skipped=./dir/big=" + big + ";./empty=;";
+        return tar;
+    }
+
+    void testArchiveReader()
+    {
+        std::string expected;
+        const std::string tar = sampleTar(expected);
+        const std::string path = "unittests.archive";
+
+        writeFile(path + ".tar", tar);
+        CHECK(expected == readArchive(path + ".tar", Codec::none()));
+        Poco::File(path + ".tar").remove();
+
+        // Archive in two frames, the first one is without checksum
+        const Codec& zstd = Codec::byName("zstd");
+        const std::string zst = zstdFrame(tar.substr(0, 1536), false) + zstdFrame(tar.substr(1536), true);
+        writeFile(path + ".tar.zst", zst);
+        CHECK(expected == readArchive(path + ".tar.zst", zstd));
+
+        // Output of one small frame takes several decoder buffers
+        std::string large, content(300000, 'z');
+        tarMember(large, "./large", '0', content);
+        large.append(1024, '\0');
+        writeFile(path + ".tar.zst", zstdFrame(large, true));
+        CHECK("./large=" + content + ";" == readArchive(path + ".tar.zst", zstd));
+
+        // Members of the first frame are read, the cut one fails instead of ending archive
+        const std::string first = zstdFrame(tar.substr(0, 1536), false);
+        writeFile(path + ".tar.zst", zst.substr(0, first.size() + (zst.size() - first.size()) / 2));
+        const std::string truncated = readArchive(path + ".tar.zst", zstd);
+        CHECK(0 == truncated.find("./dir/=;./dir/a.txt=hello;"));
+        CHECK(truncated.size() - 5 == truncated.rfind("error"));
+        // Frame without checksum has no trailer to cut, its last byte is content
+        writeFile(path + ".tar.zst", first.substr(0, first.size() - 1));
+        const std::string cut = readArchive(path + ".tar.zst", zstd);
+        CHECK(cut.size() - 5 == cut.rfind("error"));
+        Poco::File(path + ".tar.zst").remove();
+    }
+
+    std::string readFile(const std::string& path)
+    {
+        Poco::FileInputStream in(path, std::ios::in | std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Target rebuilt from base and delta against its signature, size of delta or -1 on mismatch
+    Poco::Int64 deltaRoundTrip(const std::string& base, const std::string& target, unsigned blockSize)
+    {
+        const std::string path = "unittests.delta";
+        writeFile(path + ".base", base);
+        writeFile(path + ".target", target);
+        BinaryDelta::signature(path + ".base", path + ".sig", blockSize, 0, 0);
+        const Poco::Int64 size = BinaryDelta::encode(path + ".sig", path + ".target", path + ".delta");
+        BinaryDelta::patch(path + ".base", path + ".delta", path + ".patched");
+        const bool same = target == readFile(path + ".patched") &&
+            static_cast<Poco::UInt64>(size) == Poco::File(path + ".delta").getSize();
+        const char* suffixes[] = { ".base", ".target", ".sig", ".delta", ".patched" };
+        for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i)
+            Poco::File(path + suffixes[i]).remove();
+        return same ? size : -1;
+    }
+
+    void testBinaryDelta()
+    {
+        // Pseudo random content, blocks of it do not repeat
+        std::string content;
+        unsigned seed = 1;
+        for (int i = 0; i < 100000; ++i) {
+            seed = seed * 1103515245 + 12345;
+            content += static_cast<char>(seed >> 16);
+        }
+        const Poco::Int64 header = 4 + 1 + 4; // magic and end with crc32
+
+        // Empty base: whole target is one literal, empty both is end only
+        CHECK(header + 5 + 1000 == deltaRoundTrip("", content.substr(0, 1000), 64));
+        CHECK(header == deltaRoundTrip("", "", 64));
+        CHECK(header == deltaRoundTrip(content, "", 1024));
+
+        // Identical inputs are one copy and tail shorter than block as literal
+        const Poco::Int64 tail = content.size() % 1024;
+        CHECK(header + 17 + 5 + tail == deltaRoundTrip(content, content, 1024));
+        CHECK(header + 17 == deltaRoundTrip(content.substr(0, 65536), content.substr(0, 65536), 1024));
+        // Target shorter than block matches nothing
+        CHECK(header + 5 + 100 == deltaRoundTrip(content.substr(0, 100), content.substr(0, 100), 1024));
+
+        // Appended data follows copy of whole blocks as literal, with base tail
+        const std::string base = content.substr(0, 65536 + 100);
+        CHECK(header + 17 + 5 + 100 + 5000 == deltaRoundTrip(base, base + content.substr(90000, 5000), 1024));
+        // Changed byte in the middle costs one block of literal
+        std::string changed = content;
+        changed[50000] ^= 1;
+        const Poco::Int64 size = deltaRoundTrip(content, changed, 1024);
+        CHECK(size > 0 && size <= header + 3 * 17 + 2 * 5 + 1024 + tail);
+    }
+}
+
+int main()
+{
+    testIgnoreGlob();
+    testGlobAutomaton();
+    testIgnoreRegex();
+    testIgnoreExt();
+    testPathFilterExact();
+    testPathFilterWholeSite();
+    testParseMLSD();
+    testParseName();
+    testParseLongYear();
+    testListOffset();
+    testSameModify();
+    testArchiveReader();
+    testBinaryDelta();
+
+    if (failures)
+        std::cerr << failures << " checks failed" << std::endl;
+    else
+        std::cout << "All checks passed" << std::endl;
+    return failures;
+}
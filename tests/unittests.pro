@@ -0,0 +1,20 @@
+# -------------------------------------------------
+# Checks of parsers, matchers, archive reader and delta, run as ./unittests
+# -------------------------------------------------
+QT -= core \
+    gui
+TEMPLATE = app
+TARGET = unittests
+SOURCES += unittests.cpp \
+    ../ignorematcher.cpp \
+    ../globautomaton.cpp \
+    ../listparser.cpp \
+    ../archivereader.cpp \
+    ../binarydelta.cpp \
+    ../codec.cpp
+INCLUDEPATH += ..
+CONFIG(debug, debug|release):LIBS += -lPocoFoundationd \
+    -lPocoUtild
+else:LIBS += -lPocoFoundation \
+    -lPocoUtil
+LIBS += -lzstd
@@ -0,0 +1,162 @@
+#include "tracer.h"
+#include "main.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <Poco/File.h>
+#include <Poco/Format.h>
+#include <Poco/Thread.h>
+#include <Poco/Timestamp.h>
+#include <Poco/FileStream.h>
+
+namespace
+{
+    // Names are file paths and ftp arguments, anything may be there
+    std::string jsonEscape(const std::string& str)
+    {
+        std::string ret;
+        ret.reserve(str.size());
+        for (size_t i = 0, count = str.size(); i < count; ++i) {
+            const unsigned char c = str[i];
+            if ('"' == c || '\\' == c) {
+                ret += '\\';
+                ret += c;
+            } else if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                ret += buf;
+            } else
+                ret += c;
+        }
+        return ret;
+    }
+}
+
+bool Tracer::_enabled = false;
+double Tracer::_sample = 1;
+double Tracer::_budget = 0;
+Poco::Int64 Tracer::_slow = 0;
+size_t Tracer::_maxEvents = 0;
+size_t Tracer::_dropped = 0;
+std::string Tracer::_path;
+std::vector<Tracer::Event> Tracer::_events;
+Poco::FastMutex Tracer::_mutex;
+
+void Tracer::start()
+{
+    Poco::FastMutex::ScopedLock lock(_mutex);
+    _path = App::config("trace.path");
+    _sample = std::min(1.0, std::max(0.0, App::get().config().getDouble("trace.sample", 1)));
+    _slow = Poco::Int64(App::get().config().getInt("trace.slowMs", 100)) * 1000;
+    _maxEvents = std::max(1, App::get().config().getInt("trace.maxEvents", 1000000));
+    _budget = 0;
+    _dropped = 0;
+    _enabled = !_path.empty();
+    if (_enabled) Poco::File(_path).createDirectories();
+}
+
+void Tracer::flush()
+{
+    std::vector<Event> events;
+    size_t dropped;
+    {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        if (_events.empty()) return;
+        events.swap(_events);
+        dropped = _dropped;
+        _dropped = 0;
+    }
+    write(events, dropped);
+}
+
+void Tracer::stop()
+{
+    {
+        Poco::FastMutex::ScopedLock lock(_mutex);
+        _enabled = false;
+    }
+    flush();
+}
+
+Poco::Int64 Tracer::now()
+{
+    return Poco::Timestamp().epochMicroseconds();
+}
+
+void Tracer::complete(const char* category, const std::string& name, Poco::Int64 start)
+{
+    const Poco::Int64 end = now();
+    const Poco::Thread* thread = Poco::Thread::current();
+
+    Poco::FastMutex::ScopedLock lock(_mutex);
+    if (!_enabled) return;
+    if (end - start < _slow) { // fast span is sampled
+        _budget += _sample;
+        if (_budget < 1) return;
+        _budget -= 1;
+    }
+    if (_events.size() >= _maxEvents) {
+        ++_dropped;
+        return;
+    }
+
+    _events.push_back(Event());
+    Event& e = _events.back();
+    e.category = category;
+    e.name = name;
+    e.ts = start;
+    e.dur = end - start;
+    e.tid = thread ? thread->id() : 0; // 0 is main thread
+}
+
+void Tracer::write(std::vector<Event>& events, size_t dropped)
+{
+    const std::string path = Poco::format("%s/trace-%?d.json", _path, now());
+    try {
+        Poco::FileOutputStream out(path, std::ios::out | std::ios::trunc);
+        const int pid = getpid();
+        out << "{\"traceEvents\":[\n";
+        for (size_t i = 0, count = events.size(); i < count; ++i) {
+            const Event& e = events[i];
+            out << (i ? ",\n" : "") << "{\"name\":\"" << jsonEscape(e.name) << "\",\"cat\":\"" << e.category
+                << "\",\"ph\":\"X\",\"ts\":" << e.ts << ",\"dur\":" << e.dur
+                << ",\"pid\":" << pid << ",\"tid\":" << e.tid << '}';
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":" << dropped << "}}\n";
+        out.close();
+        App::logger().information(Poco::format("Trace of %z spans written to %s", events.size(), path));
+    } catch (Poco::Exception& ex) {
+        App::logger().error("Unable to write trace " + path + "\n" + ex.displayText());
+    }
+}
+
+Tracer::Span::Span(const char* category, const std::string& name) :
+    _category(category), _start(_enabled ? now() : 0)
+{
+    if (_start) _name = name; // copied only when traced
+}
+
+Tracer::Span::~Span()
+{
+    if (_start) complete(_category, _name, _start);
+}
+
+Tracer::ScopedLock::ScopedLock(Poco::FastMutex& mutex, const char* category, const char* name) :
+    _mutex(mutex), _category(category), _name(name), _start(0)
+{
+    if (!_enabled) {
+        _mutex.lock();
+        return;
+    }
+    const Poco::Int64 wait = now();
+    _mutex.lock();
+    complete("lock", _name, wait);
+    _start = now();
+}
+
+Tracer::ScopedLock::~ScopedLock()
+{
+    _mutex.unlock();
+    if (_start) complete(_category, _name, _start);
+}
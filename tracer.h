@@ -0,0 +1,78 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <string>
+#include <vector>
+#include <Poco/Mutex.h>
+#include <Poco/Types.h>
+
+// Spans of ftp commands, data connections, database statements and lock
+// waits written as Chrome trace event JSON (chrome://tracing, Perfetto) to
+// trace.path, one file per run. Spans shorter than trace.slowMs are kept
+// with probability trace.sample, slower ones always. Disabled if trace.path
+// is empty, then spans cost one flag check.
+class Tracer
+{
+public:
+    static bool enabled() { return _enabled; }
+
+    // Start collecting spans with current configuration
+    static void start();
+    // Write collected spans to new file, collecting goes on
+    static void flush();
+    // Write collected spans and stop
+    static void stop();
+
+    // Microseconds since epoch
+    static Poco::Int64 now();
+    // Record span from start till now on current thread
+    static void complete(const char* category, const std::string& name, Poco::Int64 start);
+
+    // Span of scope
+    class Span
+    {
+    public:
+        Span(const char* category, const std::string& name);
+        ~Span();
+
+    private:
+        const char* _category;
+        std::string _name;
+        Poco::Int64 _start;
+    };
+
+    // Scoped lock of mutex, wait for it is "lock" span and holding it is category span
+    class ScopedLock
+    {
+    public:
+        ScopedLock(Poco::FastMutex& mutex, const char* category, const char* name);
+        ~ScopedLock();
+
+    private:
+        Poco::FastMutex& _mutex;
+        const char* _category;
+        const char* _name;
+        Poco::Int64 _start;
+    };
+
+private:
+    struct Event
+    {
+        const char* category;
+        std::string name;
+        Poco::Int64 ts, dur;
+        unsigned long tid;
+    };
+
+    static void write(std::vector<Event>& events, size_t dropped);
+
+    static bool _enabled;
+    static double _sample, _budget;
+    static Poco::Int64 _slow; // microseconds
+    static size_t _maxEvents, _dropped;
+    static std::string _path;
+    static std::vector<Event> _events;
+    static Poco::FastMutex _mutex;
+};
+
+#endif // TRACER_H